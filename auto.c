@@ -0,0 +1,461 @@
+/* Self-tuning engine.
+ *
+ * Wraps one of the real engines (robin hood with double hashing to start
+ * with) and counts the mix of inserts, lookups and removes over the
+ * first AUTO_WARMUP operations, keeping a copy of the counts as they
+ * stand at that point. At the first resize after that (an insert
+ * or table_reserve that would grow the inner table) it picks the engine
+ * suited to the mix and migrates in place of the grow, since every entry
+ * is being moved then anyway. The copy reuses the stored hashes:
+ *
+ *   removes >= 20% of ops     hopscotch; removes leave no tombstones
+ *   lookups >= 80% of ops,    cuckoo; a lookup reads at most two buckets,
+ *   or >= 50% with at least   hit or miss, where a robin hood miss walks
+ *   half of them missing      its whole probe window
+ *   otherwise                 robin hood
+ *
+ * Key lengths play no part: every engine stores a pointer to a borrowed
+ * key, so slot layout and probe cost do not depend on them, and the
+ * compare a hit pays for is the same whichever engine found it.
+ *
+ * For robin hood it keeps linear probing only if the keys' mean probe
+ * length stays within AUTO_LINEAR_SLACK of double hashing's at the same
+ * size; linear probes share cache lines but cluster on weak hashes. The
+ * double hashing rebuild is measured, linear probing's mean is worked out
+ * from the stored hashes, so at most two tables (the old one and one
+ * rebuild) plus a word per slot exist at once.
+ *
+ * The choice is made once. Keys and data stay borrowed as with any table.
+ *
+ * Inserts, lookups and removes call the inner engine's ops directly: the
+ * dispatch layer has already counted, timed and sampled them against the
+ * auto table. The inner table carries the same trace hook, so the
+ * engine's own events (long probes, recycled-slot searches) still fire.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table_internal.h"
+
+#define AUTO_WARMUP 4096
+#define AUTO_LINEAR_SLACK 0.5
+
+/* The op counts the choice is made from */
+struct mix {
+    unsigned long ops;
+    unsigned long gets;
+    unsigned long get_hits;
+    unsigned long removes;
+};
+
+struct auto_table {
+    struct table_base base;
+    table_t inner;
+    struct table_config cfg;    /* the inner table's current config */
+    struct mix warm;            /* counts at the end of warmup, all 0 until then */
+    int decided;
+};
+
+static const struct table_ops auto_ops;
+
+static unsigned long observed(struct auto_table *at)
+{
+    return at->base.inserts + at->base.gets + at->base.removes;
+}
+
+/* Whether warmup is over, taking the copy of the counts the first time
+ * it is. Called ahead of every op, so the copy covers AUTO_WARMUP ops
+ * give or take the one in flight
+ */
+static int warmed(struct auto_table *at)
+{
+    struct mix *m = &at->warm;
+
+    if(m->ops)
+        return 1;
+    if(observed(at) < AUTO_WARMUP)
+        return 0;
+    m->ops = observed(at);
+    m->gets = at->base.gets;
+    m->get_hits = at->base.get_hits;
+    m->removes = at->base.removes;
+    return 1;
+}
+
+static void choose(struct auto_table *at, struct table_config *c)
+{
+    struct mix *m = &at->warm;
+    double ops = m->ops;
+
+    *c = at->cfg;
+    c->engine = TABLE_ENGINE_ROBIN_HOOD;
+    c->probe = TABLE_PROBE_DOUBLE;
+
+    if(m->removes >= 0.2 * ops)
+        c->engine = TABLE_ENGINE_HOPSCOTCH;
+    else if(m->gets >= 0.8 * ops ||
+            (m->gets >= 0.5 * ops && m->get_hits <= 0.5 * m->gets))
+        c->engine = TABLE_ENGINE_CUCKOO;
+    else
+        c->probe = TABLE_PROBE_LINEAR;
+}
+
+static double mean_probe(table_t t)
+{
+    struct table_stats st;
+
+    if(table_get_stats(t, &st) || st.elements == 0)
+        return 0;
+    return (double)st.totalweight / st.elements;
+}
+
+/* Mean probe length the inner table's keys would have under linear
+ * probing in a table of size slots. Robin hood only reorders the keys of
+ * a cluster, so its total displacement is plain linear probing's, which
+ * follows from how many keys start at each slot: sweeping the slots, one
+ * waiting key settles in each and the rest are displaced past it. The
+ * first pass only settles what wraps round from the end. -1 if out of
+ * memory.
+ */
+static double linear_mean_probe(struct table *in, size_t size)
+{
+    unsigned int *home = calloc(size, sizeof(*home));
+    unsigned long long total = 0;
+    size_t pos, waiting = 0;
+    int pass;
+
+    if(!home)
+        return -1;
+    if(!in->elements) {
+        free(home);
+        return 0;
+    }
+    /* a key's first probe is hash + step, and step is 1 */
+    for(pos = rh_next_alive(in, 0); pos < in->size; pos = rh_next_alive(in, pos + 1))
+        home[(in->table[pos].hash + 1) % size]++;
+    for(pass = 0; pass < 2; pass++) {
+        for(pos = 0; pos < size; pos++) {
+            waiting += home[pos];
+            if(waiting)
+                waiting--;
+            if(pass)
+                total += waiting;
+        }
+    }
+    free(home);
+    return 1 + (double)total / in->elements;
+}
+
+/* Whether n more inserts would grow the inner table, which is still the
+ * starting robin hood table while undecided
+ */
+static int inner_grows(struct auto_table *at, size_t n)
+{
+    struct table *in = at->inner;
+    return (size_t)((in->elements + n) / in->max_load) + 1 > in->size;
+}
+
+/* A table of config c holding the undecided inner table's entries, with
+ * room for n. The stored hashes carry over to a robin hood table
+ */
+static table_t rebuild(struct auto_table *at, const struct table_config *c, size_t n)
+{
+    struct table *in = at->inner;
+    struct entry *e;
+    table_t t;
+    size_t pos;
+
+    if(!(t = table_new_ex(c)))
+        return NULL;
+    if(table_reserve(t, n)) {
+        table_free(t);
+        return NULL;
+    }
+    for(pos = rh_next_alive(in, 0); pos < in->size; pos = rh_next_alive(in, pos + 1)) {
+        e = &in->table[pos];
+        if(table_insert_hashed(t, e->hash, e->key, e->keylen, e->data)) {
+            table_free(t);
+            return NULL;
+        }
+    }
+    return t;
+}
+
+/* Settle on a config and rebuild the inner table into it, in place of
+ * the grow that n more inserts would cause. On failure the old inner
+ * table stays.
+ */
+static int migrate(struct auto_table *at, size_t n)
+{
+    struct table *in = at->inner;
+    struct table_config c, d;
+    unsigned long long start = table_now_ns();
+    size_t want = in->elements + n, grown = in->size * in->growth * in->max_load;
+    double linear;
+    table_t t;
+
+    at->decided = 1;
+    choose(at, &c);
+    if(c.engine == at->cfg.engine && c.probe == at->cfg.probe)
+        return 0;
+
+    /* at least what the grow would have given */
+    want = want > grown ? want : grown;
+
+    /* Linear probing has to hold up against double hashing at the same
+     * size and load. The double hashing rebuild comes first and serves as
+     * the grow if linear loses; if linear wins it goes before the linear
+     * rebuild is made
+     */
+    if(c.probe == TABLE_PROBE_LINEAR) {
+        d = c;
+        d.probe = TABLE_PROBE_DOUBLE;
+        if(!(t = rebuild(at, &d, want)))
+            return -1;
+        linear = linear_mean_probe(in, ((struct table *)t)->size);
+        if(linear < 0 || linear > mean_probe(t) + AUTO_LINEAR_SLACK) {
+            c = d;
+        } else {
+            table_free(t);
+            if(!(t = rebuild(at, &c, want)))
+                return -1;
+        }
+    } else if(!(t = rebuild(at, &c, want))) {
+        return -1;
+    }
+
+    table_free(at->inner);
+    at->inner = t;
+    at->cfg = c;
+    ((struct table_base *)t)->trace = at->base.trace;
+    at->base.grow_ns += table_now_ns() - start;
+    return 0;
+}
+
+static int auto_insert(table_t t, void *key, size_t keylen, void *data)
+{
+    struct auto_table *at = t;
+    struct table_base *in;
+    unsigned long long grown;
+    int ret;
+
+    if(warmed(at) && !at->decided && inner_grows(at, 1))
+        migrate(at, 1);
+    in = at->inner;
+    grown = in->grow_ns;
+    ret = in->ops->insert(in, key, keylen, data);
+    at->base.grow_ns += in->grow_ns - grown;
+    return ret;
+}
+
+static int auto_insert_batch(table_t t, void **keys, const size_t *keylens, void **datas, size_t n, int *results)
+{
+    struct auto_table *at = t;
+    struct table_base *in;
+    unsigned long long grown;
+    size_t i, failed = 0;
+    int ret, r;
+
+    if(warmed(at) && !at->decided && inner_grows(at, n))
+        migrate(at, n);
+    in = at->inner;
+    grown = in->grow_ns;
+    if(in->ops->insert_batch) {
+        ret = in->ops->insert_batch(in, keys, keylens, datas, n, results);
+    } else {
+        for(i = 0; i < n; i++) {
+            r = in->ops->insert(in, keys[i], keylens[i], datas[i]);
+            if(results)
+                results[i] = r;
+            failed += r != 0;
+        }
+        ret = failed ? -1 : 0;
+    }
+    at->base.grow_ns += in->grow_ns - grown;
+    return ret;
+}
+
+static int auto_get(table_t t, void *key, size_t keylen, void **dataptr)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    warmed(at);
+    return in->ops->get(in, key, keylen, dataptr);
+}
+
+static int auto_remove(table_t t, void *key, size_t keylen)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    warmed(at);
+    return in->ops->remove(in, key, keylen);
+}
+
+static int auto_iter(table_t t, iter_func f, void *arg)
+{
+    struct auto_table *at = t;
+    return table_iter(at->inner, f, arg);
+}
+
+static void *auto_fetch_key(table_t t, void *key, size_t keylen)
+{
+    struct auto_table *at = t;
+    return table_fetch_key(at->inner, key, keylen);
+}
+
+static void *auto_fetch_val(table_t t, void *key, size_t keylen)
+{
+    struct auto_table *at = t;
+    return table_fetch_val(at->inner, key, keylen);
+}
+
+static int auto_get_stats(table_t t, struct table_stats *st)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+
+    if(in->ops->get_stats(in, st))
+        return -1;
+    st->memory += sizeof(*at);
+    return 0;
+}
+
+static void auto_print_stats(table_t t)
+{
+    struct auto_table *at = t;
+
+    if(at->decided)
+        printf("Auto engine: %s%s, chosen from the first %lu ops\n", table_engine_name(at->cfg.engine),
+               at->cfg.engine == TABLE_ENGINE_ROBIN_HOOD ?
+               (at->cfg.probe == TABLE_PROBE_LINEAR ? " (linear)" : " (double hashing)") : "",
+               at->warm.ops);
+    else if(at->warm.ops)
+        printf("Auto engine: warmed up after %lu ops, choosing at the next grow\n", at->warm.ops);
+    else
+        printf("Auto engine: warming up, %lu of %d ops\n", observed(at), AUTO_WARMUP);
+    table_print_stats(at->inner);
+}
+
+static void auto_free(table_t t)
+{
+    struct auto_table *at = t;
+    table_free(at->inner);
+    free(at);
+}
+
+void auto_set_trace(table_t t)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    in->trace = at->base.trace;
+}
+
+static int auto_reserve(table_t t, size_t n)
+{
+    struct auto_table *at = t;
+    struct table_base *in;
+    unsigned long long grown;
+    int ret;
+
+    /* a failed or declined migration leaves the reserve to the old table */
+    if(warmed(at) && !at->decided && inner_grows(at, n))
+        migrate(at, n);
+    in = at->inner;
+    grown = in->grow_ns;
+    ret = table_reserve(in, n);
+    at->base.grow_ns += in->grow_ns - grown;
+    return ret;
+}
+
+static table_t auto_clone(table_t t)
+{
+    struct auto_table *at = t, *c = malloc(sizeof(*c));
+
+    if(!c)
+        return NULL;
+    memcpy(c, at, sizeof(*c));
+    if(!(c->inner = table_clone(at->inner))) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void auto_probe_counts(table_t t, unsigned long *counts, size_t n)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    in->ops->probe_counts(in, counts, n);
+}
+
+static int auto_key_probes(table_t t, void *key, size_t keylen)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    return in->ops->key_probes(in, key, keylen);
+}
+
+static int auto_find(table_t t, unsigned long hash, cmp_func cmp, void *key, size_t keylen, void **dataptr)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    warmed(at);
+    return in->ops->find(in, hash, cmp, key, keylen, dataptr);
+}
+
+static size_t auto_dump_slots(table_t t, struct table_slot *slots, size_t n)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    return in->ops->dump_slots(in, slots, n);
+}
+
+static size_t auto_erase_if(table_t t, iter_func pred, void *arg, int shrink)
+{
+    struct auto_table *at = t;
+    struct table_base *in = at->inner;
+    unsigned long long grown = in->grow_ns;
+    size_t removed = in->ops->erase_if(in, pred, arg, shrink);
+
+    at->base.grow_ns += in->grow_ns - grown;
+    return removed;
+}
+
+table_t auto_new(const struct table_config *cfg)
+{
+    struct auto_table *at = calloc(1, sizeof(*at));
+
+    if(!at)
+        return NULL;
+    at->cfg = *cfg;
+    at->cfg.engine = TABLE_ENGINE_ROBIN_HOOD;
+    at->cfg.probe = TABLE_PROBE_DOUBLE;
+    if(!(at->inner = table_new_ex(&at->cfg))) {
+        free(at);
+        return NULL;
+    }
+    at->base.ops = &auto_ops;
+    at->base.engine = TABLE_ENGINE_AUTO;
+    return at;
+}
+
+static const struct table_ops auto_ops = {
+    .insert = auto_insert,
+    .get = auto_get,
+    .remove = auto_remove,
+    .iter = auto_iter,
+    .fetch_key = auto_fetch_key,
+    .fetch_val = auto_fetch_val,
+    .print_stats = auto_print_stats,
+    .get_stats = auto_get_stats,
+    .free = auto_free,
+    .reserve = auto_reserve,
+    .clone = auto_clone,
+    .probe_counts = auto_probe_counts,
+    .key_probes = auto_key_probes,
+    .find = auto_find,
+    .dump_slots = auto_dump_slots,
+    .insert_batch = auto_insert_batch,
+    .erase_if = auto_erase_if,
+};
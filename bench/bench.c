@@ -0,0 +1,140 @@
+/* Shared helpers for the benchmark drivers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "table.h"
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile over sorted samples */
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t idx = (size_t)(p / 100.0 * n);
+    if(idx >= n)
+        idx = n - 1;
+    return sorted[idx];
+}
+
+void bench_report_latency(const char *name, uint64_t *samples, size_t n)
+{
+    size_t i = 0;
+    double sum = 0;
+
+    if(n == 0) {
+        printf("%-8s count 0\n", name);
+        return;
+    }
+
+    qsort(samples, n, sizeof(*samples), cmp_u64);
+    for(; i < n; i++)
+        sum += samples[i];
+
+    printf("%-8s count %zu mean %.0fns p50 %lluns p90 %lluns p99 %lluns p99.9 %lluns max %lluns\n",
+           name, n, sum / n,
+           (unsigned long long)percentile(samples, n, 50),
+           (unsigned long long)percentile(samples, n, 90),
+           (unsigned long long)percentile(samples, n, 99),
+           (unsigned long long)percentile(samples, n, 99.9),
+           (unsigned long long)samples[n - 1]);
+}
+
+void bench_hist_reset(struct bench_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static size_t hist_index(uint64_t v)
+{
+    int msb;
+
+    if(v < (1u << BENCH_HIST_SUB_BITS))
+        return v;
+    msb = 63 - __builtin_clzll(v);
+    return ((size_t)(msb - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS) +
+           ((v >> (msb - BENCH_HIST_SUB_BITS)) & ((1u << BENCH_HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_highest(size_t idx)
+{
+    size_t sub = idx & ((1u << BENCH_HIST_SUB_BITS) - 1);
+    int shift;
+
+    if(idx < (1u << BENCH_HIST_SUB_BITS))
+        return idx;
+    shift = (idx >> BENCH_HIST_SUB_BITS) - 1;
+    return ((((uint64_t)1 << BENCH_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void bench_hist_record(struct bench_hist *h, uint64_t v)
+{
+    h->counts[hist_index(v)]++;
+    h->total++;
+    if(v > h->max)
+        h->max = v;
+}
+
+uint64_t bench_hist_percentile(const struct bench_hist *h, double p)
+{
+    uint64_t want = (uint64_t)(p / 100.0 * h->total), seen = 0;
+    size_t i = 0;
+
+    if(want >= h->total)
+        return h->max;
+    for(; i < BENCH_HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if(seen > want)
+            return hist_highest(i) < h->max ? hist_highest(i) : h->max;
+    }
+    return h->max;
+}
+
+void bench_hist_report(const char *name, const struct bench_hist *h)
+{
+    if(h->total == 0) {
+        printf("  %-8s count 0\n", name);
+        return;
+    }
+    printf("  %-8s count %llu p50 %lluns p99 %lluns p99.9 %lluns max %lluns\n", name,
+           (unsigned long long)h->total,
+           (unsigned long long)bench_hist_percentile(h, 50),
+           (unsigned long long)bench_hist_percentile(h, 99),
+           (unsigned long long)bench_hist_percentile(h, 99.9),
+           (unsigned long long)h->max);
+}
+
+int bench_parse_engine(const char *name)
+{
+    int e = 0;
+    for(; e < TABLE_ENGINE_COUNT; e++)
+        if(!strcmp(name, table_engine_name(e)))
+            return e;
+    return -1;
+}
+
+void bench_report_table(void *table)
+{
+    struct table_stats st;
+
+    if(table_get_stats(table, &st))
+        return;
+
+    printf("table    %s size %zu elements %zu load %.3f avg probe %.2f max probe %u memory %zu bytes\n",
+           table_engine_name(st.engine), st.size, st.elements, st.size ? (double)st.elements / st.size : 0.0,
+           st.elements ? (double)st.totalweight / st.elements : 0.0,
+           st.maxprobe, st.memory);
+    printf("         grows %lu recycled-slot searches %lu\n", st.grows, st.recycle_searches);
+}
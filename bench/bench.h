@@ -0,0 +1,41 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shared helpers for the benchmark drivers */
+
+uint64_t bench_now_ns(void);
+
+/* Sort samples in place and print count/mean/percentiles on one line */
+void bench_report_latency(const char *name, uint64_t *samples, size_t n);
+
+/* Log-linear latency histogram in the style of HdrHistogram: values below
+ * 32 are exact, above that each power of two is split into 32 buckets, so
+ * any recorded value is reported within ~3%.
+ */
+#define BENCH_HIST_SUB_BITS 5
+#define BENCH_HIST_BUCKETS ((64 - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS)
+
+struct bench_hist {
+    uint64_t counts[BENCH_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+void bench_hist_reset(struct bench_hist *h);
+void bench_hist_record(struct bench_hist *h, uint64_t v);
+/* Highest value equivalent to the bucket holding percentile p */
+uint64_t bench_hist_percentile(const struct bench_hist *h, double p);
+void bench_hist_report(const char *name, const struct bench_hist *h);
+
+/* Engine name as accepted by -e ("robinhood", "cuckoo", "hopscotch"),
+ * -1 if unknown
+ */
+int bench_parse_engine(const char *name);
+
+/* Print the table counters collected via table_get_stats */
+void bench_report_table(void *table);
+
+#endif
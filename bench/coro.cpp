@@ -0,0 +1,111 @@
+/* Coroutine-interleaved lookups versus plain table_get.
+ *
+ * usage: coro [-e engine] [-n keys] [-l lookups] [-g max-group] [-S seed]
+ *
+ * Fills a table with n keys (pick n so the table is well out of cache)
+ * and looks up random present keys, first one table_get at a time, then
+ * through table_coro::interleaver with group sizes 1, 2, 4 ... max-group.
+ *
+ * Built by `make bench` as build/coro.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+
+#include "table.h"
+#include "table_coro.hpp"
+
+extern "C" {
+#include "bench.h"
+#include "workload.h"
+}
+
+int main(int argc, char **argv)
+{
+    struct wl_config cfg;
+    struct workload wl;
+    struct table_config tc = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL };
+    std::size_t nlookups = 1000000, maxgroup = 32, i, g;
+    uint64_t t0, t1, sum = 0;
+    double plain;
+    int opt, e;
+
+    wl_config_default(&cfg);
+    cfg.keyspace = 2000000;
+    while((opt = getopt(argc, argv, "e:n:l:g:S:")) != -1) {
+        switch(opt) {
+        case 'e':
+            if((e = bench_parse_engine(optarg)) < 0)
+                goto usage;
+            tc.engine = (enum table_engine)e;
+            break;
+        case 'n':
+            cfg.keyspace = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            nlookups = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            maxgroup = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            cfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if(optind != argc || nlookups == 0)
+        goto usage;
+
+    {
+        table_t t = table_new_ex(&tc);
+        std::vector<void *> keys(nlookups), datas(nlookups);
+        std::vector<std::size_t> keylens(nlookups);
+        std::vector<int> rets(nlookups);
+
+        if(!t || wl_init(&wl, &cfg)) {
+            std::fprintf(stderr, "coro: setup failed\n");
+            return 1;
+        }
+        table_reserve(t, cfg.keyspace);
+        for(i = 0; i < cfg.keyspace; i++)
+            table_insert(t, wl.keys[i], wl.keylens[i], wl.keys[i]);
+        for(i = 0; i < nlookups; i++) {
+            uint32_t k = wl_next_key(&wl);
+            keys[i] = wl.keys[k];
+            keylens[i] = wl.keylens[k];
+        }
+
+        t0 = bench_now_ns();
+        for(i = 0; i < nlookups; i++) {
+            void *d;
+            sum += !table_get(t, keys[i], keylens[i], &d);
+        }
+        t1 = bench_now_ns();
+        plain = (double)(t1 - t0) / nlookups;
+        std::printf("engine %s keys %zu lookups %zu\n", table_engine_name(tc.engine), cfg.keyspace, nlookups);
+        std::printf("plain      %7.1f ns/lookup  hits %llu\n", plain, (unsigned long long)sum);
+
+        for(g = 1; g <= maxgroup; g *= 2) {
+            t0 = bench_now_ns();
+            table_coro::get_many(t, keys.data(), keylens.data(), nlookups, datas.data(), rets.data(), g);
+            t1 = bench_now_ns();
+            for(sum = 0, i = 0; i < nlookups; i++)
+                sum += !rets[i];
+            std::printf("group %-4zu %7.1f ns/lookup  hits %llu  speedup %.2fx\n", g,
+                        (double)(t1 - t0) / nlookups, (unsigned long long)sum,
+                        plain / ((double)(t1 - t0) / nlookups));
+        }
+
+        bench_report_table(t);
+        table_free(t);
+        wl_destroy(&wl);
+    }
+    return 0;
+
+usage:
+    std::fprintf(stderr, "usage: %s [-e engine] [-n keys] [-l lookups] [-g max-group] [-S seed]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,227 @@
+/* Tail latency harness.
+ *
+ * usage: latency [-e engine] [-d dist] [-n keys] [-o ops] [-m get:insert] [-k min:max]
+ *                [-s skew] [-W worst] [-S seed]
+ *
+ * Every operation is timed individually with clock_gettime and recorded in
+ * log-linear histograms. The run has two phases: "fill" inserts the whole
+ * key space (driving every grow_table), "churn" runs the generated op mix
+ * against the full table (tombstones and recycled-slot searches). Within a
+ * phase, operations that triggered grow_table or a recycled-slot search are
+ * also tallied separately, and the slowest operations are listed.
+ *
+ * Built by `make bench` as build/latency.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "bench.h"
+#include "workload.h"
+
+enum { CLASS_PLAIN, CLASS_GROW, CLASS_RECYCLE };
+static const char *class_names[] = { "", "grow", "recycle" };
+
+struct slow_op {
+    uint64_t ns;
+    size_t index;
+    uint8_t op;
+    uint8_t class;
+};
+
+struct phase {
+    const char *name;
+    struct bench_hist all;
+    struct bench_hist op[TRACE_NOPS];
+    struct bench_hist grow;
+    struct bench_hist recycle;
+    struct slow_op *worst;
+    size_t nworst;
+    size_t maxworst;
+};
+
+/* Keep the slowest ops sorted descending, insertion into a short array */
+static void note_slow(struct phase *ph, uint64_t ns, size_t index, uint8_t op, uint8_t class)
+{
+    size_t i;
+
+    if(ph->maxworst == 0)
+        return;
+    if(ph->nworst == ph->maxworst && ph->worst[ph->nworst - 1].ns >= ns)
+        return;
+    if(ph->nworst < ph->maxworst)
+        ph->nworst++;
+    for(i = ph->nworst - 1; i > 0 && ph->worst[i - 1].ns < ns; i--)
+        ph->worst[i] = ph->worst[i - 1];
+    ph->worst[i].ns = ns;
+    ph->worst[i].index = index;
+    ph->worst[i].op = op;
+    ph->worst[i].class = class;
+}
+
+static void run_op(table_t t, struct workload *wl, struct phase *ph, size_t index, uint8_t op, uint32_t k)
+{
+    struct table_stats before, after;
+    uint64_t t0, t1;
+    uint8_t class = CLASS_PLAIN;
+    void *data;
+
+    table_get_stats(t, &before);
+    t0 = bench_now_ns();
+    switch(op) {
+    case TRACE_INSERT:
+        table_insert(t, wl->keys[k], wl->keylens[k], wl->keys[k]);
+        break;
+    case TRACE_GET:
+        table_get(t, wl->keys[k], wl->keylens[k], &data);
+        break;
+    case TRACE_REMOVE:
+        table_remove(t, wl->keys[k], wl->keylens[k]);
+        break;
+    }
+    t1 = bench_now_ns();
+    table_get_stats(t, &after);
+
+    bench_hist_record(&ph->all, t1 - t0);
+    bench_hist_record(&ph->op[op], t1 - t0);
+    if(after.grows != before.grows) {
+        class = CLASS_GROW;
+        bench_hist_record(&ph->grow, t1 - t0);
+    } else if(after.recycle_searches != before.recycle_searches) {
+        class = CLASS_RECYCLE;
+        bench_hist_record(&ph->recycle, t1 - t0);
+    }
+    note_slow(ph, t1 - t0, index, op, class);
+}
+
+static void report(struct phase *ph)
+{
+    size_t i = 0;
+    int op;
+
+    printf("phase %s\n", ph->name);
+    bench_hist_report("all", &ph->all);
+    for(op = 0; op < TRACE_NOPS; op++)
+        bench_hist_report(trace_op_names[op], &ph->op[op]);
+    bench_hist_report("grow", &ph->grow);
+    bench_hist_report("recycle", &ph->recycle);
+    if(ph->nworst)
+        printf("  slowest:\n");
+    for(; i < ph->nworst; i++)
+        printf("    #%-10zu %-6s %10lluns %s\n", ph->worst[i].index,
+               trace_op_names[ph->worst[i].op], (unsigned long long)ph->worst[i].ns,
+               class_names[ph->worst[i].class]);
+}
+
+static int phase_init(struct phase *ph, const char *name, size_t maxworst)
+{
+    memset(ph, 0, sizeof(*ph));
+    ph->name = name;
+    ph->maxworst = maxworst;
+    ph->worst = calloc(maxworst ? maxworst : 1, sizeof(*ph->worst));
+    return ph->worst ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct wl_config cfg;
+    struct workload wl;
+    struct wl_op *ops;
+    struct phase *fill, *churn;
+    struct table_config tc = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL };
+    size_t nops = 1000000, maxworst = 10, i;
+    table_t t;
+    int opt, d;
+
+    wl_config_default(&cfg);
+    cfg.keyspace = 1000000;
+    cfg.get_pct = 50;
+    cfg.insert_pct = 25;
+    while((opt = getopt(argc, argv, "e:d:n:o:m:k:s:W:S:")) != -1) {
+        switch(opt) {
+        case 'e':
+            if((d = bench_parse_engine(optarg)) < 0)
+                goto usage;
+            tc.engine = d;
+            break;
+        case 'd':
+            if((d = wl_parse_dist(optarg)) < 0)
+                goto usage;
+            cfg.dist = d;
+            break;
+        case 'n':
+            cfg.keyspace = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            nops = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            if(sscanf(optarg, "%u:%u", &cfg.get_pct, &cfg.insert_pct) != 2 ||
+               cfg.get_pct + cfg.insert_pct > 100)
+                goto usage;
+            break;
+        case 'k':
+            if(sscanf(optarg, "%u:%u", &cfg.keylen_min, &cfg.keylen_max) != 2)
+                goto usage;
+            break;
+        case 's':
+            cfg.skew = atof(optarg);
+            break;
+        case 'W':
+            maxworst = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            cfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if(optind != argc)
+        goto usage;
+
+    /* The histograms are large, keep them off the stack */
+    fill = malloc(sizeof(*fill));
+    churn = malloc(sizeof(*churn));
+    ops = malloc((nops ? nops : 1) * sizeof(*ops));
+    if(!fill || !churn || !ops || phase_init(fill, "fill", maxworst) ||
+       phase_init(churn, "churn", maxworst) || wl_init(&wl, &cfg)) {
+        fprintf(stderr, "latency: setup failed\n");
+        return 1;
+    }
+    wl_generate(&wl, ops, nops);
+
+    t = table_new_ex(&tc);
+    if(!t) {
+        fprintf(stderr, "latency: table_new_ex failed\n");
+        return 1;
+    }
+
+    for(i = 0; i < cfg.keyspace; i++)
+        run_op(t, &wl, fill, i, TRACE_INSERT, i);
+    for(i = 0; i < nops; i++)
+        run_op(t, &wl, churn, i, ops[i].op, ops[i].key);
+
+    printf("workload %s keys %zu churn ops %zu mix %u/%u/%u\n",
+           wl_dist_names[cfg.dist], cfg.keyspace, nops,
+           cfg.get_pct, cfg.insert_pct, 100 - cfg.get_pct - cfg.insert_pct);
+    report(fill);
+    report(churn);
+    bench_report_table(t);
+
+    table_free(t);
+    free(fill->worst);
+    free(churn->worst);
+    free(fill);
+    free(churn);
+    free(ops);
+    wl_destroy(&wl);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-e engine] [-d dist] [-n keys] [-o ops] [-m get:insert] [-k min:max]\n"
+                    "       [-s skew] [-W worst] [-S seed]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,381 @@
+/* Slot layout visualiser.
+ *
+ * usage: layout [-e engine] [-p double|linear] [-d dist] [-n keys] [-k min:max]
+ *               [-i keyfile] [-x remove%] [-r reserve] [-S seed]
+ *               [-w width] [-h rows] [-c csv] [-b bin]
+ *
+ * Fills a table with a key set (a synthetic workload's key space, or one
+ * key per line from -i), optionally removes a share of it again to leave
+ * tombstones, and dumps the slot array through table_dump_slots. Prints
+ * a heatmap of occupancy and of mean probe length across the slot array,
+ * a histogram of probe lengths and one of cluster lengths (runs of
+ * occupied or dead slots).
+ *
+ *   -r  table_reserve before filling, to look at a lower load factor
+ *   -c  write every slot as CSV: slot,state,probe,hash
+ *   -b  write every slot in binary: the header "TSLOTS01", a little-endian
+ *       u64 slot count, then per slot a u8 state and a little-endian u16
+ *       probe length (clamped to 65535)
+ *
+ * Built by `make bench` as build/layout.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "bench.h"
+#include "workload.h"
+
+#define HIST_BUCKETS 24
+#define BAR_WIDTH 50
+
+static const char ramp[] = " .:-=+*#%@";
+static const char *state_names[] = { "empty", "alive", "dead" };
+
+struct keyset {
+    char **keys;
+    size_t *keylens;
+    size_t n;
+    char *buf;
+};
+
+static int load_keys(const char *path, struct keyset *ks)
+{
+    FILE *f = fopen(path, "rb");
+    size_t len, cap = 0, i, off = 0;
+    char *p;
+
+    if(!f)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    if(!(ks->buf = malloc(len + 1)) || fread(ks->buf, 1, len, f) != len) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    ks->buf[len] = '\n';
+
+    for(i = 0; i <= len; i++)
+        cap += ks->buf[i] == '\n';
+    ks->keys = malloc((cap ? cap : 1) * sizeof(*ks->keys));
+    ks->keylens = malloc((cap ? cap : 1) * sizeof(*ks->keylens));
+    if(!ks->keys || !ks->keylens)
+        return -1;
+
+    for(ks->n = 0; off < len; off = p - ks->buf + 1) {
+        p = memchr(ks->buf + off, '\n', len + 1 - off);
+        if(p > ks->buf + off) {
+            ks->keys[ks->n] = ks->buf + off;
+            ks->keylens[ks->n++] = p - (ks->buf + off);
+        }
+    }
+    return 0;
+}
+
+static int from_workload(struct wl_config *cfg, struct workload *wl, struct keyset *ks)
+{
+    size_t i;
+
+    if(wl_init(wl, cfg))
+        return -1;
+    ks->n = cfg->keyspace;
+    ks->keys = wl->keys;
+    if(!(ks->keylens = malloc((ks->n ? ks->n : 1) * sizeof(*ks->keylens))))
+        return -1;
+    for(i = 0; i < ks->n; i++)
+        ks->keylens[i] = wl->keylens[i];
+    return 0;
+}
+
+static void put_le(FILE *f, uint64_t v, int bytes)
+{
+    for(; bytes > 0; bytes--, v >>= 8)
+        fputc(v & 0xff, f);
+}
+
+static int write_csv(const char *path, const struct table_slot *s, size_t n)
+{
+    FILE *f = fopen(path, "w");
+    size_t i = 0;
+
+    if(!f)
+        return -1;
+    fprintf(f, "slot,state,probe,hash\n");
+    for(; i < n; i++)
+        fprintf(f, "%zu,%s,%u,%lu\n", i, state_names[s[i].state], s[i].probe, s[i].hash);
+    return fclose(f);
+}
+
+static int write_bin(const char *path, const struct table_slot *s, size_t n)
+{
+    FILE *f = fopen(path, "wb");
+    size_t i = 0;
+
+    if(!f)
+        return -1;
+    fwrite("TSLOTS01", 1, 8, f);
+    put_le(f, n, 8);
+    for(; i < n; i++) {
+        fputc(s[i].state, f);
+        put_le(f, s[i].probe < 65535 ? s[i].probe : 65535, 2);
+    }
+    return fclose(f);
+}
+
+/* One cell per run of slots: occupancy as a share of the ramp, or the
+ * mean probe length of the live slots scaled against the longest mean
+ */
+static void heatmap(const struct table_slot *s, size_t n, unsigned int width, unsigned int rows, int probe)
+{
+    size_t cells = (size_t)width * rows, c, i, lo, hi, alive;
+    double *v = calloc(cells, sizeof(*v)), max = 0;
+    unsigned long sum;
+    int level;
+
+    if(!v || n == 0) {
+        free(v);
+        return;
+    }
+    if(cells > n)
+        cells = n;
+
+    for(c = 0; c < cells; c++) {
+        lo = n * c / cells;
+        hi = n * (c + 1) / cells;
+        for(i = lo, alive = 0, sum = 0; i < hi; i++) {
+            alive += s[i].state == TABLE_SLOT_ALIVE;
+            sum += s[i].state == TABLE_SLOT_ALIVE ? s[i].probe : 0;
+        }
+        v[c] = probe ? (alive ? (double)sum / alive : -1) : (double)alive / (hi - lo);
+        if(v[c] > max)
+            max = v[c];
+    }
+    if(!probe)
+        max = 1;
+
+    printf("%s, %zu slots per cell%s\n", probe ? "mean probe length" : "occupancy",
+           n / cells, probe ? "" : " (' ' empty .. '@' full)");
+    for(c = 0; c < cells; c++) {
+        if(v[c] < 0 || max == 0)
+            level = 0;
+        else
+            level = 1 + (int)(v[c] / max * (sizeof(ramp) - 3) + 0.5);
+        if(!probe && v[c] == 0)
+            level = 0;
+        putchar(ramp[level < (int)sizeof(ramp) - 1 ? level : (int)sizeof(ramp) - 2]);
+        if((c + 1) % width == 0 || c + 1 == cells)
+            putchar('\n');
+    }
+    if(probe)
+        printf("('.' shortest .. '@' longest = %.2f, ' ' no live slots)\n", max);
+    putchar('\n');
+    free(v);
+}
+
+/* Histogram with power of two buckets: 0, 1, 2-3, 4-7, ... */
+static void histogram(const char *name, const unsigned long *counts, unsigned long total)
+{
+    unsigned long max = 0;
+    int b, last = -1;
+
+    for(b = 0; b < HIST_BUCKETS; b++) {
+        if(counts[b] > max)
+            max = counts[b];
+        if(counts[b])
+            last = b;
+    }
+    printf("%s\n", name);
+    for(b = 0; b <= last; b++) {
+        unsigned long lo = b ? 1UL << (b - 1) : 0, hi = b ? (1UL << b) - 1 : 0;
+        int bar = max ? (int)(counts[b] * BAR_WIDTH / max) : 0;
+        char label[48];
+        if(lo == hi)
+            snprintf(label, sizeof(label), "%lu", lo);
+        else
+            snprintf(label, sizeof(label), "%lu-%lu", lo, hi);
+        printf("  %-16s %10lu %5.1f%% ", label, counts[b], total ? 100.0 * counts[b] / total : 0);
+        while(bar-- > 0)
+            putchar('#');
+        putchar('\n');
+    }
+    putchar('\n');
+}
+
+static int bucket(unsigned long v)
+{
+    int b = 0;
+    for(; v; v >>= 1)
+        b++;
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+static void report(const struct table_slot *s, size_t n, unsigned int width, unsigned int rows)
+{
+    unsigned long probes[HIST_BUCKETS] = {0}, clusters[HIST_BUCKETS] = {0};
+    unsigned long state[3] = {0}, nclusters = 0, run = 0, longest = 0, first = 0;
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        state[s[i].state]++;
+        if(s[i].state == TABLE_SLOT_ALIVE)
+            probes[bucket(s[i].probe)]++;
+        if(s[i].state != TABLE_SLOT_EMPTY) {
+            run++;
+            continue;
+        }
+        /* a run touching slot 0 may wrap around; finish it at the end */
+        if(run && run == i) {
+            first = run;
+        } else if(run) {
+            clusters[bucket(run)]++;
+            nclusters++;
+        }
+        if(run > longest)
+            longest = run;
+        run = 0;
+    }
+    run += first;
+    if(run) {
+        clusters[bucket(run)]++;
+        nclusters++;
+        if(run > longest)
+            longest = run;
+    }
+
+    printf("slots %zu alive %lu dead %lu empty %lu load %.3f\n", n,
+           state[TABLE_SLOT_ALIVE], state[TABLE_SLOT_DEAD], state[TABLE_SLOT_EMPTY],
+           n ? (double)(state[TABLE_SLOT_ALIVE] + state[TABLE_SLOT_DEAD]) / n : 0);
+    printf("clusters %lu mean %.2f longest %lu\n\n", nclusters,
+           nclusters ? (double)(state[TABLE_SLOT_ALIVE] + state[TABLE_SLOT_DEAD]) / nclusters : 0, longest);
+
+    heatmap(s, n, width, rows, 0);
+    heatmap(s, n, width, rows, 1);
+    histogram("probe length", probes, state[TABLE_SLOT_ALIVE]);
+    histogram("cluster length (occupied or dead slots in a row)", clusters, nclusters);
+}
+
+int main(int argc, char **argv)
+{
+    struct table_config tc = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL, TABLE_PROBE_DOUBLE };
+    struct wl_config cfg;
+    struct workload wl;
+    struct keyset ks = { NULL, NULL, 0, NULL };
+    struct table_slot *slots;
+    const char *keyfile = NULL, *csv = NULL, *bin = NULL;
+    unsigned int width = 64, rows = 16, remove_pct = 0;
+    size_t reserve = 0, n = 0, i, inserted = 0, removed = 0;
+    int opt, v;
+    table_t t;
+
+    wl_config_default(&cfg);
+    while((opt = getopt(argc, argv, "e:p:d:n:k:i:x:r:S:w:h:c:b:")) != -1) {
+        switch(opt) {
+        case 'e':
+            if((v = bench_parse_engine(optarg)) < 0)
+                goto usage;
+            tc.engine = v;
+            break;
+        case 'p':
+            if(!strcmp(optarg, "linear"))
+                tc.probe = TABLE_PROBE_LINEAR;
+            else if(strcmp(optarg, "double"))
+                goto usage;
+            break;
+        case 'd':
+            if((v = wl_parse_dist(optarg)) < 0)
+                goto usage;
+            cfg.dist = v;
+            break;
+        case 'n':
+            cfg.keyspace = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            if(sscanf(optarg, "%u:%u", &cfg.keylen_min, &cfg.keylen_max) != 2)
+                goto usage;
+            break;
+        case 'i':
+            keyfile = optarg;
+            break;
+        case 'x':
+            remove_pct = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            reserve = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            cfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            width = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            rows = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            csv = optarg;
+            break;
+        case 'b':
+            bin = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if(optind != argc || remove_pct > 100 || width == 0 || rows == 0)
+        goto usage;
+
+    if(keyfile ? load_keys(keyfile, &ks) : from_workload(&cfg, &wl, &ks)) {
+        fprintf(stderr, "layout: cannot load keys\n");
+        return 1;
+    }
+
+    if(!(t = table_new_ex(&tc)) || (reserve && table_reserve(t, reserve))) {
+        fprintf(stderr, "layout: cannot create table\n");
+        return 1;
+    }
+    for(i = 0; i < ks.n; i++)
+        inserted += !table_insert(t, ks.keys[i], ks.keylens[i], ks.keys[i]);
+    /* every k-th key, spread over the key set */
+    for(i = 0; remove_pct && i < ks.n; i++) {
+        if(i * remove_pct / 100 != (i + 1) * remove_pct / 100)
+            removed += !table_remove(t, ks.keys[i], ks.keylens[i]);
+    }
+
+    table_dump_slots(t, NULL, &n);
+    if(!(slots = malloc((n ? n : 1) * sizeof(*slots))) || table_dump_slots(t, slots, &n)) {
+        fprintf(stderr, "layout: cannot dump slots\n");
+        return 1;
+    }
+
+    printf("engine %s%s keys %zu inserted %zu removed %zu\n", table_engine_name(tc.engine),
+           tc.engine == TABLE_ENGINE_ROBIN_HOOD && tc.probe == TABLE_PROBE_LINEAR ? " (linear)" : "",
+           ks.n, inserted, removed);
+    report(slots, n, width, rows);
+    bench_report_table(t);
+
+    if((csv && write_csv(csv, slots, n)) || (bin && write_bin(bin, slots, n))) {
+        fprintf(stderr, "layout: cannot write slot dump\n");
+        return 1;
+    }
+
+    free(slots);
+    table_free(t);
+    if(keyfile) {
+        free(ks.buf);
+        free(ks.keys);
+    } else {
+        wl_destroy(&wl);
+    }
+    free(ks.keylens);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-e engine] [-p double|linear] [-d dist] [-n keys] [-k min:max]\n"
+                    "       [-i keyfile] [-x remove%%] [-r reserve] [-S seed]\n"
+                    "       [-w width] [-h rows] [-c csv] [-b bin]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,145 @@
+/* Replay a recorded operation trace against the table.
+ *
+ * usage: replay [-e engine] [-p] [-s speed] trace-file
+ *   -e        robinhood (default), cuckoo or hopscotch
+ *   -p        honour the original pacing from the trace timestamps
+ *   -s speed  pacing multiplier for -p (2.0 replays twice as fast)
+ *
+ * Without -p operations are issued back to back. Reports throughput,
+ * per-op latency percentiles and the final table stats.
+ *
+ * Built by `make bench` as build/replay.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "bench.h"
+#include "trace.h"
+
+/* Trace keys are raw bytes and may hold NULs, so compare them whole
+ * rather than with the built-in string compare
+ */
+static int key_cmp(void *a, void *b, size_t len)
+{
+    return memcmp(a, b, len);
+}
+
+static void sleep_until(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+int main(int argc, char **argv)
+{
+    struct trace tr;
+    table_t t;
+    uint64_t *lat[TRACE_NOPS];
+    size_t nlat[TRACE_NOPS] = {0}, hits[TRACE_NOPS] = {0}, i = 0;
+    uint64_t start, end, maxlag = 0;
+    double speed = 1.0;
+    struct table_config tc = { TABLE_ENGINE_ROBIN_HOOD, NULL, key_cmp };
+    int paced = 0, opt, op;
+
+    while((opt = getopt(argc, argv, "e:ps:")) != -1) {
+        switch(opt) {
+        case 'e':
+            if((op = bench_parse_engine(optarg)) < 0)
+                goto usage;
+            tc.engine = op;
+            break;
+        case 'p':
+            paced = 1;
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if(optind != argc - 1 || speed <= 0)
+        goto usage;
+
+    if(trace_load(argv[optind], &tr)) {
+        fprintf(stderr, "replay: cannot load trace %s\n", argv[optind]);
+        return 1;
+    }
+
+    for(op = 0; op < TRACE_NOPS; op++) {
+        lat[op] = malloc((tr.nrecs ? tr.nrecs : 1) * sizeof(**lat));
+        if(!lat[op]) {
+            fprintf(stderr, "replay: out of memory\n");
+            return 1;
+        }
+    }
+
+    t = table_new_ex(&tc);
+    if(!t) {
+        fprintf(stderr, "replay: table_new_ex failed\n");
+        return 1;
+    }
+
+    start = bench_now_ns();
+    for(; i < tr.nrecs; i++) {
+        struct trace_rec *r = &tr.recs[i];
+        uint64_t t0, t1;
+        void *data;
+        int ret = -1;
+
+        if(paced) {
+            uint64_t due = start + (uint64_t)((r->ts - tr.recs[0].ts) / speed);
+            uint64_t now = bench_now_ns();
+            if(now < due)
+                sleep_until(due);
+            else if(now - due > maxlag)
+                maxlag = now - due;
+        }
+
+        t0 = bench_now_ns();
+        switch(r->op) {
+        case TRACE_INSERT:
+            ret = table_insert(t, r->key, r->keylen, r->key);
+            break;
+        case TRACE_GET:
+            ret = table_get(t, r->key, r->keylen, &data);
+            break;
+        case TRACE_REMOVE:
+            ret = table_remove(t, r->key, r->keylen);
+            break;
+        }
+        t1 = bench_now_ns();
+
+        lat[r->op][nlat[r->op]++] = t1 - t0;
+        if(!ret)
+            hits[r->op]++;
+    }
+    end = bench_now_ns();
+
+    printf("ops      %zu in %.3fs, %.0f ops/s%s\n", tr.nrecs, (end - start) / 1e9,
+           (end - start) ? tr.nrecs / ((end - start) / 1e9) : 0.0, paced ? " (paced)" : "");
+    if(paced)
+        printf("pacing   max lag behind schedule %lluns\n", (unsigned long long)maxlag);
+    for(op = 0; op < TRACE_NOPS; op++) {
+        bench_report_latency(trace_op_names[op], lat[op], nlat[op]);
+        if(nlat[op])
+            printf("         ok %zu failed %zu\n", hits[op], nlat[op] - hits[op]);
+        free(lat[op]);
+    }
+    bench_report_table(t);
+
+    table_free(t);
+    trace_free(&tr);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-e engine] [-p] [-s speed] trace-file\n", argv[0]);
+    return 1;
+}
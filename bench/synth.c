@@ -0,0 +1,195 @@
+/* Drive the table with a synthetic workload.
+ *
+ * usage: synth [-e engine|all] [-d dist] [-n keys] [-o ops] [-s skew]
+ *              [-H frac:prob] [-m get:insert] [-k min:max] [-f prefill%]
+ *              [-S seed] [-w trace]
+ *   -e  robinhood (default), cuckoo, hopscotch, or all to run the same
+ *       op stream against every engine
+ *   -d  uniform, zipf, hotspot, sequential or collide
+ *   -m  percentage of gets and inserts, the remainder are removes
+ *   -f  percentage of the key space inserted before the timed run
+ *   -w  also record the generated stream (prefill included) as a trace
+ *       file that replay can consume
+ *
+ * Built by `make bench` as build/synth.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "bench.h"
+#include "workload.h"
+
+static int record(FILE *f, struct workload *wl, const struct wl_op *ops, size_t n, uint64_t *ts)
+{
+    size_t i = 0;
+    for(; i < n; i++, (*ts)++)
+        if(trace_write_rec(f, ops[i].op, *ts, wl->keys[ops[i].key], wl->keylens[ops[i].key]))
+            return -1;
+    return 0;
+}
+
+static int run(enum table_engine engine, struct workload *wl,
+               const struct wl_op *pre, size_t npre, const struct wl_op *ops, size_t nops)
+{
+    struct table_config tc = { engine, NULL, NULL };
+    size_t i, count[TRACE_NOPS] = {0}, ok[TRACE_NOPS] = {0};
+    uint64_t start, end;
+    table_t t;
+    void *data;
+    int op;
+
+    t = table_new_ex(&tc);
+    if(!t) {
+        fprintf(stderr, "synth: table_new_ex failed\n");
+        return -1;
+    }
+
+    for(i = 0; i < npre; i++)
+        table_insert(t, wl->keys[pre[i].key], wl->keylens[pre[i].key], wl->keys[pre[i].key]);
+
+    start = bench_now_ns();
+    for(i = 0; i < nops; i++) {
+        uint32_t k = ops[i].key;
+        int ret = -1;
+
+        switch(ops[i].op) {
+        case TRACE_GET:
+            ret = table_get(t, wl->keys[k], wl->keylens[k], &data);
+            break;
+        case TRACE_INSERT:
+            ret = table_insert(t, wl->keys[k], wl->keylens[k], wl->keys[k]);
+            break;
+        case TRACE_REMOVE:
+            ret = table_remove(t, wl->keys[k], wl->keylens[k]);
+            break;
+        }
+        count[ops[i].op]++;
+        ok[ops[i].op] += !ret;
+    }
+    end = bench_now_ns();
+
+    printf("engine   %s\n", table_engine_name(engine));
+    printf("ops      %.3fs, %.0f ops/s, %.1f ns/op\n", (end - start) / 1e9,
+           nops ? nops / ((end - start) / 1e9) : 0.0,
+           nops ? (double)(end - start) / nops : 0.0);
+    for(op = 0; op < TRACE_NOPS; op++)
+        printf("%-8s count %zu ok %zu failed %zu\n", trace_op_names[op], count[op], ok[op], count[op] - ok[op]);
+    bench_report_table(t);
+
+    table_free(t);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct wl_config cfg;
+    struct workload wl;
+    struct wl_op *ops, *pre = NULL;
+    size_t nops = 1000000, npre, i;
+    unsigned int prefill = 50;
+    uint64_t ts = 0;
+    const char *tracefile = NULL;
+    int opt, op, engine = TABLE_ENGINE_ROBIN_HOOD, all = 0;
+
+    wl_config_default(&cfg);
+    while((opt = getopt(argc, argv, "e:d:n:o:s:H:m:k:f:S:w:")) != -1) {
+        switch(opt) {
+        case 'e':
+            if(!strcmp(optarg, "all"))
+                all = 1;
+            else if((engine = bench_parse_engine(optarg)) < 0)
+                goto usage;
+            break;
+        case 'd':
+            if((op = wl_parse_dist(optarg)) < 0)
+                goto usage;
+            cfg.dist = op;
+            break;
+        case 'n':
+            cfg.keyspace = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            nops = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            cfg.skew = atof(optarg);
+            break;
+        case 'H':
+            if(sscanf(optarg, "%lf:%lf", &cfg.hot_frac, &cfg.hot_prob) != 2)
+                goto usage;
+            break;
+        case 'm':
+            if(sscanf(optarg, "%u:%u", &cfg.get_pct, &cfg.insert_pct) != 2 ||
+               cfg.get_pct + cfg.insert_pct > 100)
+                goto usage;
+            break;
+        case 'k':
+            if(sscanf(optarg, "%u:%u", &cfg.keylen_min, &cfg.keylen_max) != 2)
+                goto usage;
+            break;
+        case 'f':
+            prefill = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            cfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            tracefile = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if(optind != argc || prefill > 100)
+        goto usage;
+
+    if(wl_init(&wl, &cfg)) {
+        fprintf(stderr, "synth: cannot build workload\n");
+        return 1;
+    }
+
+    npre = cfg.keyspace * prefill / 100;
+    ops = malloc((nops ? nops : 1) * sizeof(*ops));
+    pre = malloc((npre ? npre : 1) * sizeof(*pre));
+    if(!ops || !pre) {
+        fprintf(stderr, "synth: out of memory\n");
+        return 1;
+    }
+
+    for(i = 0; i < npre; i++) {
+        pre[i].op = TRACE_INSERT;
+        pre[i].key = i;
+    }
+    wl_generate(&wl, ops, nops);
+
+    if(tracefile) {
+        FILE *f = fopen(tracefile, "wb");
+        if(!f || trace_write_header(f) || record(f, &wl, pre, npre, &ts) ||
+           record(f, &wl, ops, nops, &ts) || fclose(f)) {
+            fprintf(stderr, "synth: cannot write trace %s\n", tracefile);
+            return 1;
+        }
+    }
+
+    printf("workload %s keys %zu prefill %zu ops %zu mix %u/%u/%u\n",
+           wl_dist_names[cfg.dist], cfg.keyspace, npre, nops,
+           cfg.get_pct, cfg.insert_pct, 100 - cfg.get_pct - cfg.insert_pct);
+    for(op = all ? 0 : engine; op < (all ? TABLE_ENGINE_COUNT : engine + 1); op++) {
+        if(run(op, &wl, pre, npre, ops, nops))
+            return 1;
+    }
+
+    free(ops);
+    free(pre);
+    wl_destroy(&wl);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-e engine|all] [-d uniform|zipf|hotspot|sequential|collide] [-n keys] [-o ops]\n"
+                    "       [-s skew] [-H frac:prob] [-m get:insert] [-k min:max] [-f prefill%%]\n"
+                    "       [-S seed] [-w trace]\n", argv[0]);
+    return 1;
+}
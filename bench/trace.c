@@ -0,0 +1,107 @@
+/* Reader and writer for recorded operation traces, see trace.h */
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define TRACE_REC_HDR 13
+
+const char *trace_op_names[TRACE_NOPS] = { "insert", "get", "remove" };
+
+static uint64_t get_le(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    while(bytes--)
+        v = (v << 8) | p[bytes];
+    return v;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int bytes)
+{
+    int i = 0;
+    for(; i < bytes; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+int trace_load(const char *path, struct trace *tr)
+{
+    FILE *f = fopen(path, "rb");
+    size_t pos = TRACE_MAGIC_LEN, cap = 0;
+    long len;
+
+    memset(tr, 0, sizeof(*tr));
+    if(!f)
+        return -1;
+
+    if(fseek(f, 0, SEEK_END) || (len = ftell(f)) < TRACE_MAGIC_LEN || fseek(f, 0, SEEK_SET))
+        goto err;
+
+    tr->buflen = len;
+    tr->buf = malloc(tr->buflen);
+    if(!tr->buf || fread(tr->buf, 1, tr->buflen, f) != tr->buflen)
+        goto err;
+    if(memcmp(tr->buf, TRACE_MAGIC, TRACE_MAGIC_LEN))
+        goto err;
+
+    while(pos < tr->buflen) {
+        struct trace_rec *r;
+
+        if(tr->buflen - pos < TRACE_REC_HDR)
+            goto err;
+        if(tr->nrecs == cap) {
+            struct trace_rec *n;
+            cap = cap ? cap * 2 : 1024;
+            n = realloc(tr->recs, cap * sizeof(*n));
+            if(!n)
+                goto err;
+            tr->recs = n;
+        }
+
+        r = &tr->recs[tr->nrecs];
+        r->ts = get_le(tr->buf + pos, 8);
+        r->keylen = get_le(tr->buf + pos + 8, 4);
+        r->op = tr->buf[pos + 12];
+        r->key = tr->buf + pos + TRACE_REC_HDR;
+        pos += TRACE_REC_HDR;
+
+        if(r->op >= TRACE_NOPS || tr->buflen - pos < r->keylen)
+            goto err;
+        pos += r->keylen;
+        tr->nrecs++;
+    }
+
+    fclose(f);
+    return 0;
+
+err:
+    fclose(f);
+    trace_free(tr);
+    return -1;
+}
+
+void trace_free(struct trace *tr)
+{
+    free(tr->buf);
+    free(tr->recs);
+    memset(tr, 0, sizeof(*tr));
+}
+
+int trace_write_header(FILE *f)
+{
+    return fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, f) == TRACE_MAGIC_LEN ? 0 : -1;
+}
+
+int trace_write_rec(FILE *f, uint8_t op, uint64_t ts, const void *key, uint32_t keylen)
+{
+    unsigned char hdr[TRACE_REC_HDR];
+
+    put_le(hdr, ts, 8);
+    put_le(hdr + 8, keylen, 4);
+    hdr[12] = op;
+
+    if(fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+        return -1;
+    if(keylen && fwrite(key, 1, keylen, f) != keylen)
+        return -1;
+    return 0;
+}
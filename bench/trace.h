@@ -0,0 +1,52 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Recorded operation traces.
+ *
+ * File layout (all integers little endian):
+ *   magic    8 bytes  "RHTRACE1"
+ *   records  repeated until EOF:
+ *     u64 timestamp in ns (relative to any fixed origin)
+ *     u32 key length
+ *     u8  op (TRACE_INSERT, TRACE_GET, TRACE_REMOVE)
+ *     key bytes
+ */
+#define TRACE_MAGIC "RHTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+enum trace_op {
+    TRACE_INSERT = 0,
+    TRACE_GET = 1,
+    TRACE_REMOVE = 2,
+    TRACE_NOPS
+};
+
+struct trace_rec {
+    uint64_t ts;
+    void *key;          /* points into trace->buf */
+    uint32_t keylen;
+    uint8_t op;
+};
+
+struct trace {
+    unsigned char *buf; /* raw file contents, keys live here */
+    size_t buflen;
+    struct trace_rec *recs;
+    size_t nrecs;
+};
+
+/* Load a trace file. Returns 0 on success, non-zero on error */
+int trace_load(const char *path, struct trace *tr);
+void trace_free(struct trace *tr);
+
+/* Writing side, used by the generators to record their streams */
+int trace_write_header(FILE *f);
+int trace_write_rec(FILE *f, uint8_t op, uint64_t ts, const void *key, uint32_t keylen);
+
+extern const char *trace_op_names[TRACE_NOPS];
+
+#endif
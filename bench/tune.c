@@ -0,0 +1,463 @@
+/* Configuration auto-tuner.
+ *
+ * usage: tune [-t trace | -i keyfile | -d dist -n keys -m get:insert ...]
+ *             [-o ops] [-W mem:lat:thr] [-a] [-S seed]
+ *
+ * Builds one op stream from a recorded trace (-t, as replay reads it), a
+ * key sample (-i, one key per line: every key inserted, then -o lookups
+ * of random keys), or a synthetic workload (the whole key space inserted,
+ * then -o generated ops), and runs it against every combination of
+ *
+ *   layout     robin hood double hashing / linear probing, cuckoo, hopscotch
+ *   max_load   0.5 0.7 0.8 0.9 0.95
+ *   growth     1.5 2 2.5 4 for robin hood, 2 and 4 for the power of two
+ *              engines
+ *   hash       djb2 (built in), fnv1a, djb2 with a murmur3 finaliser
+ *
+ * Each run measures the table's memory at the end (tables never shrink),
+ * throughput over an untimed pass and p99 latency over a second pass
+ * that times every op. The runs no other run beats on all three are the
+ * Pareto frontier; -a lists every run. The recommendation is the frontier
+ * run with the lowest weighted sum of each measure relative to the best
+ * seen, weights from -W (default 1:1:1), printed as a table_config.
+ *
+ * Built by `make bench` as build/tune.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "table.h"
+#include "bench.h"
+#include "trace.h"
+#include "workload.h"
+
+struct op {
+    void *key;
+    size_t keylen;
+    uint8_t op;
+};
+
+struct hash_choice {
+    const char *name;
+    hash_func fn;
+};
+
+struct layout {
+    const char *name;
+    enum table_engine engine;
+    enum table_probe probe;
+};
+
+struct run {
+    struct table_config cfg;
+    const char *layout;
+    const char *hash;
+    size_t memory;
+    double ops_per_s;
+    uint64_t p99;
+    int frontier;
+};
+
+static unsigned long fnv1a(void *k, size_t len)
+{
+    const unsigned char *p = k;
+    unsigned long h = 0xcbf29ce484222325UL;
+    size_t i = 0;
+
+    for(; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001b3UL;
+    return h;
+}
+
+static unsigned long djb2_mix(void *k, size_t len)
+{
+    struct table_hasher hs;
+    unsigned long h;
+
+    table_hasher_init(&hs);
+    table_hasher_update(&hs, k, len);
+    h = table_hasher_final(&hs);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+static const struct hash_choice hashes[] = {
+    { "djb2", NULL },
+    { "fnv1a", fnv1a },
+    { "djb2-mix", djb2_mix },
+};
+
+static const struct layout layouts[] = {
+    { "robinhood", TABLE_ENGINE_ROBIN_HOOD, TABLE_PROBE_DOUBLE },
+    { "robinhood-linear", TABLE_ENGINE_ROBIN_HOOD, TABLE_PROBE_LINEAR },
+    { "cuckoo", TABLE_ENGINE_CUCKOO, TABLE_PROBE_DOUBLE },
+    { "hopscotch", TABLE_ENGINE_HOPSCOTCH, TABLE_PROBE_DOUBLE },
+};
+
+static const float loads[] = { 0.5f, 0.7f, 0.8f, 0.9f, 0.95f };
+static const float rh_growths[] = { 1.5f, 2.0f, 2.5f, 4.0f };
+static const float pow2_growths[] = { 2.0f, 4.0f };
+
+#define NELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t rng_next(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static struct op *ops_from_trace(struct trace *tr, size_t *n)
+{
+    struct op *ops = malloc((tr->nrecs ? tr->nrecs : 1) * sizeof(*ops));
+    size_t i = 0;
+
+    if(!ops)
+        return NULL;
+    for(; i < tr->nrecs; i++) {
+        ops[i].key = tr->recs[i].key;
+        ops[i].keylen = tr->recs[i].keylen;
+        ops[i].op = tr->recs[i].op;
+    }
+    *n = tr->nrecs;
+    return ops;
+}
+
+/* One key per line; every key inserted, then nget lookups of random keys */
+static struct op *ops_from_keys(const char *path, size_t nget, uint64_t seed, char **bufp, size_t *n)
+{
+    FILE *f = fopen(path, "rb");
+    size_t len, nkeys = 0, i, off = 0;
+    struct op *ops;
+    char *buf, *p;
+
+    if(!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    if(!(buf = malloc(len + 1)) || fread(buf, 1, len, f) != len) {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    buf[len] = '\n';
+
+    for(i = 0; i <= len; i++)
+        nkeys += buf[i] == '\n';
+    if(!(ops = malloc((nkeys + nget + 1) * sizeof(*ops)))) {
+        free(buf);
+        return NULL;
+    }
+    for(nkeys = 0; off < len; off = p - buf + 1) {
+        p = memchr(buf + off, '\n', len + 1 - off);
+        if(p > buf + off) {
+            ops[nkeys].key = buf + off;
+            ops[nkeys].keylen = p - (buf + off);
+            ops[nkeys++].op = TRACE_INSERT;
+        }
+    }
+    seed = seed ? seed : 1;
+    for(i = 0; nkeys && i < nget; i++) {
+        ops[nkeys + i] = ops[rng_next(&seed) % nkeys];
+        ops[nkeys + i].op = TRACE_GET;
+    }
+    *n = nkeys + (nkeys ? nget : 0);
+    *bufp = buf;
+    return ops;
+}
+
+/* The whole key space inserted, then nops generated ops */
+static struct op *ops_from_workload(struct workload *wl, size_t nops, size_t *n)
+{
+    size_t nkeys = wl->cfg.keyspace, i;
+    struct wl_op *gen = malloc((nops ? nops : 1) * sizeof(*gen));
+    struct op *ops = malloc((nkeys + nops + 1) * sizeof(*ops));
+
+    if(!gen || !ops) {
+        free(gen);
+        free(ops);
+        return NULL;
+    }
+    for(i = 0; i < nkeys; i++) {
+        ops[i].key = wl->keys[i];
+        ops[i].keylen = wl->keylens[i];
+        ops[i].op = TRACE_INSERT;
+    }
+    wl_generate(wl, gen, nops);
+    for(i = 0; i < nops; i++) {
+        ops[nkeys + i].key = wl->keys[gen[i].key];
+        ops[nkeys + i].keylen = wl->keylens[gen[i].key];
+        ops[nkeys + i].op = gen[i].op;
+    }
+    free(gen);
+    *n = nkeys + nops;
+    return ops;
+}
+
+static int apply(table_t t, const struct op *o)
+{
+    void *data;
+
+    switch(o->op) {
+    case TRACE_INSERT:
+        return table_insert(t, o->key, o->keylen, o->key);
+    case TRACE_GET:
+        return table_get(t, o->key, o->keylen, &data);
+    case TRACE_REMOVE:
+        return table_remove(t, o->key, o->keylen);
+    }
+    return -1;
+}
+
+static int measure(struct run *r, const struct op *ops, size_t n, struct bench_hist *h)
+{
+    struct table_stats st;
+    uint64_t start, end, t0;
+    table_t t;
+    size_t i;
+
+    /* throughput, back to back */
+    if(!(t = table_new_ex(&r->cfg)))
+        return -1;
+    start = bench_now_ns();
+    for(i = 0; i < n; i++)
+        apply(t, &ops[i]);
+    end = bench_now_ns();
+    r->ops_per_s = end > start ? n / ((end - start) / 1e9) : 0;
+    if(table_get_stats(t, &st)) {
+        table_free(t);
+        return -1;
+    }
+    r->memory = st.memory;
+    table_free(t);
+
+    /* latency, every op timed */
+    if(!(t = table_new_ex(&r->cfg)))
+        return -1;
+    bench_hist_reset(h);
+    for(i = 0; i < n; i++) {
+        t0 = bench_now_ns();
+        apply(t, &ops[i]);
+        bench_hist_record(h, bench_now_ns() - t0);
+    }
+    r->p99 = bench_hist_percentile(h, 99);
+    table_free(t);
+    return 0;
+}
+
+/* a is at least as good as b everywhere and better somewhere */
+static int dominates(const struct run *a, const struct run *b)
+{
+    if(a->memory > b->memory || a->p99 > b->p99 || a->ops_per_s < b->ops_per_s)
+        return 0;
+    return a->memory < b->memory || a->p99 < b->p99 || a->ops_per_s > b->ops_per_s;
+}
+
+static void print_run(const struct run *r)
+{
+    printf("%-17s %-9s load %.2f growth %.1f  memory %10zu  p99 %6llu ns  %11.0f ops/s%s\n",
+           r->layout, r->hash, r->cfg.max_load, r->cfg.growth, r->memory,
+           (unsigned long long)r->p99, r->ops_per_s, r->frontier ? "  *" : "");
+}
+
+static int by_memory(const void *a, const void *b)
+{
+    const struct run *x = a, *y = b;
+    return (x->memory > y->memory) - (x->memory < y->memory);
+}
+
+static const char *engine_macro(enum table_engine e)
+{
+    switch(e) {
+    case TABLE_ENGINE_CUCKOO:
+        return "TABLE_ENGINE_CUCKOO";
+    case TABLE_ENGINE_HOPSCOTCH:
+        return "TABLE_ENGINE_HOPSCOTCH";
+    default:
+        return "TABLE_ENGINE_ROBIN_HOOD";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct wl_config wcfg;
+    struct workload wl;
+    struct trace tr;
+    struct bench_hist *hist = malloc(sizeof(*hist));
+    struct run *runs, *best = NULL;
+    struct op *ops;
+    const char *tracefile = NULL, *keyfile = NULL;
+    char *keybuf = NULL;
+    size_t nops = 0, n = 0, nruns = 0, i, j, l, g, hsh, minmem = 0;
+    double w_mem = 1, w_lat = 1, w_thr = 1, maxthr = 0, score, best_score = 0;
+    uint64_t minp99 = 0;
+    int opt, v, all = 0;
+
+    wl_config_default(&wcfg);
+    while((opt = getopt(argc, argv, "t:i:d:n:m:k:s:o:W:aS:")) != -1) {
+        switch(opt) {
+        case 't':
+            tracefile = optarg;
+            break;
+        case 'i':
+            keyfile = optarg;
+            break;
+        case 'd':
+            if((v = wl_parse_dist(optarg)) < 0)
+                goto usage;
+            wcfg.dist = v;
+            break;
+        case 'n':
+            wcfg.keyspace = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            if(sscanf(optarg, "%u:%u", &wcfg.get_pct, &wcfg.insert_pct) != 2 ||
+               wcfg.get_pct + wcfg.insert_pct > 100)
+                goto usage;
+            break;
+        case 'k':
+            if(sscanf(optarg, "%u:%u", &wcfg.keylen_min, &wcfg.keylen_max) != 2)
+                goto usage;
+            break;
+        case 's':
+            wcfg.skew = atof(optarg);
+            break;
+        case 'o':
+            nops = strtoul(optarg, NULL, 0);
+            break;
+        case 'W':
+            if(sscanf(optarg, "%lf:%lf:%lf", &w_mem, &w_lat, &w_thr) != 3)
+                goto usage;
+            break;
+        case 'a':
+            all = 1;
+            break;
+        case 'S':
+            wcfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if(optind != argc || (tracefile && keyfile))
+        goto usage;
+    if(!nops)
+        nops = 4 * wcfg.keyspace;
+
+    if(tracefile) {
+        if(trace_load(tracefile, &tr)) {
+            fprintf(stderr, "tune: cannot load trace %s\n", tracefile);
+            return 1;
+        }
+        ops = ops_from_trace(&tr, &n);
+    } else if(keyfile) {
+        ops = ops_from_keys(keyfile, nops, wcfg.seed, &keybuf, &n);
+    } else {
+        if(wl_init(&wl, &wcfg)) {
+            fprintf(stderr, "tune: cannot build workload\n");
+            return 1;
+        }
+        ops = ops_from_workload(&wl, nops, &n);
+    }
+    runs = malloc(NELEM(layouts) * NELEM(loads) * NELEM(rh_growths) * NELEM(hashes) * sizeof(*runs));
+    if(!ops || !runs || !hist) {
+        fprintf(stderr, "tune: cannot load the op stream\n");
+        return 1;
+    }
+
+    printf("%zu ops from %s\n", n, tracefile ? tracefile : keyfile ? keyfile : wl_dist_names[wcfg.dist]);
+    for(l = 0; l < NELEM(layouts); l++) {
+        int rh = layouts[l].engine == TABLE_ENGINE_ROBIN_HOOD;
+        const float *growths = rh ? rh_growths : pow2_growths;
+        size_t ngrowths = rh ? NELEM(rh_growths) : NELEM(pow2_growths);
+
+        for(g = 0; g < ngrowths; g++) {
+            for(i = 0; i < NELEM(loads); i++) {
+                for(hsh = 0; hsh < NELEM(hashes); hsh++) {
+                    struct run *r = &runs[nruns];
+                    memset(r, 0, sizeof(*r));
+                    r->cfg.engine = layouts[l].engine;
+                    r->cfg.hash = hashes[hsh].fn;
+                    r->cfg.probe = layouts[l].probe;
+                    r->cfg.max_load = loads[i];
+                    r->cfg.growth = growths[g];
+                    r->layout = layouts[l].name;
+                    r->hash = hashes[hsh].name;
+                    if(measure(r, ops, n, hist)) {
+                        fprintf(stderr, "tune: %s load %.2f growth %.1f failed\n",
+                                r->layout, loads[i], growths[g]);
+                        continue;
+                    }
+                    nruns++;
+                }
+            }
+        }
+    }
+    if(!nruns) {
+        fprintf(stderr, "tune: no run completed\n");
+        return 1;
+    }
+
+    for(i = 0; i < nruns; i++) {
+        runs[i].frontier = 1;
+        for(j = 0; j < nruns && runs[i].frontier; j++)
+            if(j != i && dominates(&runs[j], &runs[i]))
+                runs[i].frontier = 0;
+        if(!minmem || runs[i].memory < minmem)
+            minmem = runs[i].memory;
+        if(!minp99 || runs[i].p99 < minp99)
+            minp99 = runs[i].p99;
+        if(runs[i].ops_per_s > maxthr)
+            maxthr = runs[i].ops_per_s;
+    }
+    qsort(runs, nruns, sizeof(*runs), by_memory);
+
+    printf("%s (memory, p99 latency, throughput; * on the Pareto frontier)\n",
+           all ? "all runs" : "Pareto frontier");
+    for(i = 0; i < nruns; i++) {
+        if(!all && !runs[i].frontier)
+            continue;
+        print_run(&runs[i]);
+        if(!runs[i].frontier)
+            continue;
+        score = w_mem * runs[i].memory / (minmem ? minmem : 1) +
+                w_lat * runs[i].p99 / (minp99 ? minp99 : 1) +
+                w_thr * maxthr / (runs[i].ops_per_s > 0 ? runs[i].ops_per_s : 1);
+        if(!best || score < best_score) {
+            best = &runs[i];
+            best_score = score;
+        }
+    }
+
+    printf("\nrecommended (weights %g:%g:%g)\n", w_mem, w_lat, w_thr);
+    print_run(best);
+    printf("\n    struct table_config cfg = { %s, %s, NULL, %s, %.2ff, %.1ff };\n",
+           engine_macro(best->cfg.engine), best->cfg.hash ? best->hash : "NULL",
+           best->cfg.probe == TABLE_PROBE_LINEAR ? "TABLE_PROBE_LINEAR" : "TABLE_PROBE_DOUBLE",
+           best->cfg.max_load, best->cfg.growth);
+    if(best->cfg.hash)
+        printf("    /* %s is defined in bench/tune.c */\n", best->hash);
+
+    free(runs);
+    free(ops);
+    free(hist);
+    if(tracefile)
+        trace_free(&tr);
+    else if(keyfile)
+        free(keybuf);
+    else
+        wl_destroy(&wl);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-t trace | -i keyfile | -d dist -n keys -m get:insert -k min:max -s skew]\n"
+                    "       [-o ops] [-W mem:lat:thr] [-a] [-S seed]\n", argv[0]);
+    return 1;
+}
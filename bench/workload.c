@@ -0,0 +1,233 @@
+/* Synthetic key stream generator, see workload.h */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "workload.h"
+
+const char *wl_dist_names[WL_NDISTS] = {
+    "uniform", "zipf", "hotspot", "sequential", "collide"
+};
+
+/* xorshift64* */
+static uint64_t wl_rand(struct workload *wl)
+{
+    wl->rng ^= wl->rng >> 12;
+    wl->rng ^= wl->rng << 25;
+    wl->rng ^= wl->rng >> 27;
+    return wl->rng * 2685821657736338717ull;
+}
+
+static double wl_rand_unit(struct workload *wl)
+{
+    return (wl_rand(wl) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t wl_rand_below(struct workload *wl, size_t n)
+{
+    return n ? wl_rand(wl) % n : 0;
+}
+
+void wl_config_default(struct wl_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->dist = WL_UNIFORM;
+    cfg->keyspace = 100000;
+    cfg->skew = 0.99;
+    cfg->hot_frac = 0.01;
+    cfg->hot_prob = 0.9;
+    cfg->get_pct = 80;
+    cfg->insert_pct = 15;
+    cfg->keylen_min = 8;
+    cfg->keylen_max = 24;
+    cfg->seed = 0x5eed;
+}
+
+int wl_parse_dist(const char *name)
+{
+    int i = 0;
+    for(; i < WL_NDISTS; i++)
+        if(!strcmp(name, wl_dist_names[i]))
+            return i;
+    return -1;
+}
+
+/* djb2 mixes two characters as 33 * c1 + c2, and 33*'a'+'z' == 33*'b'+'Y',
+ * so any string of "az"/"bY" blocks hashes the same as any other of equal
+ * block count. Bit b of the index picks the block at position b.
+ */
+static size_t collide_keys(struct workload *wl)
+{
+    size_t n = wl->cfg.keyspace, i = 0, blocks = 1, len, b;
+    char *p;
+
+    while(blocks < 63 && ((size_t)1 << blocks) < n)
+        blocks++;
+    len = blocks * 2;
+
+    wl->keybuf = malloc(n * len);
+    if(!wl->keybuf)
+        return 0;
+
+    for(p = wl->keybuf; i < n; i++, p += len) {
+        wl->keys[i] = p;
+        wl->keylens[i] = len;
+        for(b = 0; b < blocks; b++)
+            memcpy(p + b * 2, ((i >> b) & 1) ? "bY" : "az", 2);
+    }
+    return n;
+}
+
+/* Regular keys start with the hex index (unique) and are padded with
+ * pseudo-random printable bytes up to a length drawn from the config.
+ */
+static size_t plain_keys(struct workload *wl)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t n = wl->cfg.keyspace, i = 0, total = 0, digits = 1;
+    unsigned int lo = wl->cfg.keylen_min, hi = wl->cfg.keylen_max;
+    char *p;
+
+    while(digits < 16 && ((size_t)1 << (4 * digits)) < n)
+        digits++;
+    if(lo < digits)
+        lo = digits;
+    if(hi < lo)
+        hi = lo;
+
+    for(; i < n; i++) {
+        wl->keylens[i] = lo + wl_rand_below(wl, hi - lo + 1);
+        total += wl->keylens[i];
+    }
+
+    wl->keybuf = malloc(total);
+    if(!wl->keybuf)
+        return 0;
+
+    for(i = 0, p = wl->keybuf; i < n; p += wl->keylens[i], i++) {
+        size_t j = 0, v = i;
+        wl->keys[i] = p;
+        for(; j < digits; j++, v >>= 4)
+            p[j] = hex[v & 0xf];
+        for(; j < wl->keylens[i]; j++)
+            p[j] = 'A' + wl_rand_below(wl, 26);
+    }
+    return n;
+}
+
+static int zipf_init(struct workload *wl)
+{
+    size_t n = wl->cfg.keyspace, i = 0;
+    double sum = 0;
+
+    wl->cdf = malloc(n * sizeof(*wl->cdf));
+    wl->perm = malloc(n * sizeof(*wl->perm));
+    if(!wl->cdf || !wl->perm)
+        return -1;
+
+    for(; i < n; i++) {
+        sum += 1.0 / pow((double)(i + 1), wl->cfg.skew);
+        wl->cdf[i] = sum;
+    }
+    for(i = 0; i < n; i++) {
+        wl->cdf[i] /= sum;
+        wl->perm[i] = i;
+    }
+    /* Fisher-Yates so popular ranks are spread over the key space */
+    for(i = n - 1; i > 0; i--) {
+        size_t j = wl_rand_below(wl, i + 1);
+        uint32_t tmp = wl->perm[i];
+        wl->perm[i] = wl->perm[j];
+        wl->perm[j] = tmp;
+    }
+    return 0;
+}
+
+int wl_init(struct workload *wl, const struct wl_config *cfg)
+{
+    size_t made;
+
+    memset(wl, 0, sizeof(*wl));
+    wl->cfg = *cfg;
+    wl->rng = cfg->seed ? cfg->seed : 1;
+
+    if(cfg->keyspace == 0 || cfg->keyspace > UINT32_MAX || cfg->dist >= WL_NDISTS)
+        return -1;
+
+    wl->keys = malloc(cfg->keyspace * sizeof(*wl->keys));
+    wl->keylens = malloc(cfg->keyspace * sizeof(*wl->keylens));
+    if(!wl->keys || !wl->keylens)
+        goto err;
+
+    made = cfg->dist == WL_COLLIDE ? collide_keys(wl) : plain_keys(wl);
+    if(!made)
+        goto err;
+
+    if(cfg->dist == WL_ZIPF && zipf_init(wl))
+        goto err;
+
+    return 0;
+
+err:
+    wl_destroy(wl);
+    return -1;
+}
+
+void wl_destroy(struct workload *wl)
+{
+    free(wl->keys);
+    free(wl->keylens);
+    free(wl->keybuf);
+    free(wl->cdf);
+    free(wl->perm);
+    memset(wl, 0, sizeof(*wl));
+}
+
+uint32_t wl_next_key(struct workload *wl)
+{
+    size_t n = wl->cfg.keyspace, hot;
+
+    switch(wl->cfg.dist) {
+    case WL_ZIPF: {
+        double u = wl_rand_unit(wl);
+        size_t lo = 0, hi = n - 1;
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if(wl->cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return wl->perm[lo];
+    }
+    case WL_HOTSPOT:
+        hot = (size_t)(n * wl->cfg.hot_frac);
+        if(hot == 0)
+            hot = 1;
+        if(hot >= n || wl_rand_unit(wl) < wl->cfg.hot_prob)
+            return wl_rand_below(wl, hot);
+        return hot + wl_rand_below(wl, n - hot);
+    case WL_SEQUENTIAL:
+        if(wl->seq >= n)
+            wl->seq = 0;
+        return wl->seq++;
+    default:
+        return wl_rand_below(wl, n);
+    }
+}
+
+void wl_generate(struct workload *wl, struct wl_op *ops, size_t n)
+{
+    size_t i = 0;
+
+    for(; i < n; i++) {
+        unsigned int r = wl_rand_below(wl, 100);
+        if(r < wl->cfg.get_pct)
+            ops[i].op = TRACE_GET;
+        else if(r < wl->cfg.get_pct + wl->cfg.insert_pct)
+            ops[i].op = TRACE_INSERT;
+        else
+            ops[i].op = TRACE_REMOVE;
+        ops[i].key = wl_next_key(wl);
+    }
+}
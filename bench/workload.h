@@ -0,0 +1,68 @@
+#ifndef _WORKLOAD_H
+#define _WORKLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+/* Synthetic key stream generator.
+ *
+ * A workload owns a fixed key space of `keyspace` materialised keys (the
+ * table borrows key pointers so they must stay put) and draws operations
+ * over it according to an access distribution and an op mix. Ops are
+ * generated up front by wl_generate so the RNG stays out of the timed loop.
+ */
+enum wl_dist {
+    WL_UNIFORM,
+    WL_ZIPF,        /* rank r drawn with probability ~ 1/r^skew */
+    WL_HOTSPOT,     /* hot_prob of accesses land in hot_frac of the keys */
+    WL_SEQUENTIAL,  /* walk the key space in order, wrapping */
+    WL_COLLIDE,     /* every key has the same djb2 hash */
+    WL_NDISTS
+};
+
+struct wl_config {
+    enum wl_dist dist;
+    size_t keyspace;
+    double skew;            /* WL_ZIPF exponent */
+    double hot_frac;        /* WL_HOTSPOT */
+    double hot_prob;
+    unsigned int get_pct;   /* op mix, remainder after get+insert is remove */
+    unsigned int insert_pct;
+    unsigned int keylen_min;/* key lengths drawn uniformly from [min, max] */
+    unsigned int keylen_max;
+    uint64_t seed;
+};
+
+struct wl_op {
+    uint8_t op;             /* enum trace_op */
+    uint32_t key;           /* index into the key space */
+};
+
+struct workload {
+    struct wl_config cfg;
+    char **keys;
+    uint32_t *keylens;
+    char *keybuf;
+    double *cdf;            /* WL_ZIPF cumulative distribution over ranks */
+    uint32_t *perm;         /* rank -> key index so hot keys are scattered */
+    size_t seq;
+    uint64_t rng;
+};
+
+void wl_config_default(struct wl_config *cfg);
+int wl_init(struct workload *wl, const struct wl_config *cfg);
+void wl_destroy(struct workload *wl);
+
+/* Fill ops[0..n) with the next n operations */
+void wl_generate(struct workload *wl, struct wl_op *ops, size_t n);
+
+/* Draw a single key index from the access distribution */
+uint32_t wl_next_key(struct workload *wl);
+
+/* Parse a distribution name ("uniform", "zipf", ...), -1 if unknown */
+int wl_parse_dist(const char *name);
+extern const char *wl_dist_names[WL_NDISTS];
+
+#endif
@@ -0,0 +1,608 @@
+/* Bucketised cuckoo hashing engine.
+ *
+ * Every key has two candidate buckets of four slots. A bucket holds only
+ * the stored hashes and key pointers (one 64 byte line), so a lookup reads
+ * at most two bucket lines before touching a key. Data pointers and key
+ * lengths live in a parallel array and are read on a hit only.
+ * Inserts that find both buckets full evict a resident to its alternate
+ * bucket, up to CUCKOO_MAX_KICKS times, before growing the table.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "table_internal.h"
+
+#define CUCKOO_WAYS 4
+#define CUCKOO_BUCKETS_DEFAULT 128
+#define CUCKOO_MAX_LOAD_FACTOR 0.90
+#define CUCKOO_MIN_GROW_LOAD 0.50
+#define CUCKOO_MAX_KICKS 256
+
+#define MIN_PROBE(p, n) ((p) < (n) ? (p) : (n) - 1)
+
+struct cuckoo_bucket {
+    unsigned long hash[CUCKOO_WAYS];
+    void *key[CUCKOO_WAYS];
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct cuckoo_bucket) == 64, "a cuckoo bucket is one cache line");
+
+struct cuckoo_aux {
+    void *data;
+    size_t keylen;
+};
+
+struct cuckoo_table {
+    struct table_base base;
+    struct cuckoo_bucket *buckets;
+    struct cuckoo_aux *aux;     /* nbuckets * CUCKOO_WAYS, same order as the slots */
+    size_t nbuckets;            /* power of two */
+    size_t elements;            /* including overflow */
+    size_t secondary;           /* entries living in their alternate bucket */
+    unsigned long grows;
+    unsigned long rng;
+    struct overflow ovf;
+    double max_load;
+    unsigned int grow_shift;    /* each grow multiplies the size by 2^grow_shift */
+    hash_func hash;
+    cmp_func cmp;
+};
+
+static const struct table_ops cuckoo_ops;
+
+/* Both buckets come from a remixed hash (murmur3 finaliser): the low
+ * and high halves of the result pick bucket one and two. The bucket
+ * count is a power of two, so the raw hash's low bits alone would
+ * cluster on similar keys.
+ */
+static unsigned long cuckoo_mix(unsigned long hash)
+{
+    unsigned long h = hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+static size_t bucket1(struct cuckoo_table *ct, unsigned long hash)
+{
+    return cuckoo_mix(hash) & (ct->nbuckets - 1);
+}
+
+static size_t bucket2(struct cuckoo_table *ct, unsigned long hash)
+{
+    return (cuckoo_mix(hash) >> 32) & (ct->nbuckets - 1);
+}
+
+static ssize_t cuckoo_search(struct cuckoo_table *ct, unsigned long hash, cmp_func cmp, void *key, size_t keylen)
+{
+    size_t b[2], i = 0;
+    int w;
+
+    b[0] = bucket1(ct, hash);
+    b[1] = bucket2(ct, hash);
+    __builtin_prefetch(&ct->buckets[b[1]]);
+
+    for(; i < 2; i++) {
+        struct cuckoo_bucket *bk = &ct->buckets[b[i]];
+        for(w = 0; w < CUCKOO_WAYS; w++) {
+            if(bk->key[w] && bk->hash[w] == hash && !cmp(key, bk->key[w], keylen))
+                return b[i] * CUCKOO_WAYS + w;
+        }
+    }
+    return -1;
+}
+
+/* Slots read by a lookup that ended at slot `s` or overflow entry `oe`:
+ * the ways of bucket one, then bucket two, then the overflow list
+ */
+static void cuckoo_trace_probes(struct cuckoo_table *ct, unsigned long hash, void *key, size_t keylen,
+                                ssize_t s, struct overflow_entry *oe)
+{
+    unsigned int probes, limit = ct->base.trace.probe_threshold;
+
+    if(s >= 0)
+        probes = ((size_t)s / CUCKOO_WAYS == bucket1(ct, hash) ? 0 : CUCKOO_WAYS) + s % CUCKOO_WAYS + 1;
+    else
+        probes = 2 * CUCKOO_WAYS + (oe ? oe - ct->ovf.e + 1 : ct->ovf.n);
+    if(limit && probes > limit)
+        table_trace_fire(&ct->base, TABLE_TRACE_LONG_PROBE, key, keylen, hash, probes, 0);
+}
+
+/* Slot holding the key, or -1 with *oe set to its overflow entry (NULL
+ * when absent). The lookup behind get, remove, fetch and find.
+ */
+static ssize_t cuckoo_lookup(struct cuckoo_table *ct, unsigned long hash, cmp_func cmp, void *key, size_t keylen,
+                             struct overflow_entry **oe)
+{
+    ssize_t s = cuckoo_search(ct, hash, cmp, key, keylen);
+
+    *oe = NULL;
+    if(s < 0 && ct->ovf.n)
+        *oe = overflow_find(&ct->ovf, cmp, hash, key, keylen);
+    if(TRACE_ON(&ct->base))
+        cuckoo_trace_probes(ct, hash, key, keylen, s, *oe);
+    return s;
+}
+
+static void set_slot(struct cuckoo_table *ct, size_t b, int w, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    size_t s = b * CUCKOO_WAYS + w;
+    ct->buckets[b].hash[w] = hash;
+    ct->buckets[b].key[w] = key;
+    ct->aux[s].data = data;
+    ct->aux[s].keylen = keylen;
+    if(b != bucket1(ct, hash))
+        ct->secondary++;
+}
+
+static void clear_slot(struct cuckoo_table *ct, size_t b, int w)
+{
+    if(b != bucket1(ct, ct->buckets[b].hash[w]))
+        ct->secondary--;
+    ct->buckets[b].key[w] = NULL;
+}
+
+static int free_way(struct cuckoo_bucket *bk)
+{
+    int w = 0;
+    for(; w < CUCKOO_WAYS; w++)
+        if(!bk->key[w])
+            return w;
+    return -1;
+}
+
+/* Place a key known to be absent. Walks an eviction chain when both
+ * buckets are full; whatever is left homeless goes to the overflow list.
+ * Returns 1 if something had to overflow, -1 on allocation failure.
+ */
+static int cuckoo_place(struct cuckoo_table *ct, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    size_t b = bucket1(ct, hash), kicks = 0;
+    int w;
+
+    if((w = free_way(&ct->buckets[b])) < 0) {
+        b = bucket2(ct, hash);
+        w = free_way(&ct->buckets[b]);
+    }
+
+    /* The chain may end with an evicted key to overflow; make room for it
+     * first so a failed allocation never leaves a resident homeless
+     */
+    if(w < 0 && overflow_room(&ct->ovf))
+        return -1;
+
+    while(w < 0 && kicks++ < CUCKOO_MAX_KICKS) {
+        unsigned long vhash;
+        void *vkey, *vdata;
+        size_t vkeylen, s;
+
+        /* Evict a pseudo-random resident of b and take its slot */
+        ct->rng = ct->rng * 6364136223846793005UL + 1442695040888963407UL;
+        w = (ct->rng >> 33) % CUCKOO_WAYS;
+        s = b * CUCKOO_WAYS + w;
+        vhash = ct->buckets[b].hash[w];
+        vkey = ct->buckets[b].key[w];
+        vdata = ct->aux[s].data;
+        vkeylen = ct->aux[s].keylen;
+
+        clear_slot(ct, b, w);
+        set_slot(ct, b, w, hash, key, keylen, data);
+
+        hash = vhash;
+        key = vkey;
+        data = vdata;
+        keylen = vkeylen;
+        b = (b == bucket1(ct, hash)) ? bucket2(ct, hash) : bucket1(ct, hash);
+        w = free_way(&ct->buckets[b]);
+    }
+
+    if(w < 0)
+        return overflow_add(&ct->ovf, hash, key, keylen, data) ? -1 : 1;
+
+    set_slot(ct, b, w, hash, key, keylen, data);
+    return 0;
+}
+
+/* Bucket array on cache line boundaries; calloc only promises 16 bytes,
+ * which would split most buckets over two lines
+ */
+static struct cuckoo_bucket *bucket_array(size_t nbuckets)
+{
+    return aligned_alloc(64, nbuckets * sizeof(struct cuckoo_bucket));
+}
+
+static int cuckoo_alloc(struct cuckoo_table *ct, size_t nbuckets)
+{
+    if((ct->buckets = bucket_array(nbuckets)))
+        memset(ct->buckets, 0, nbuckets * sizeof(*ct->buckets));
+    ct->aux = calloc(nbuckets * CUCKOO_WAYS, sizeof(*ct->aux));
+    if(!ct->buckets || !ct->aux) {
+        free(ct->buckets);
+        free(ct->aux);
+        return -1;
+    }
+    ct->nbuckets = nbuckets;
+    return 0;
+}
+
+/* Rebuild with nbuckets buckets and re-place everything, overflow
+ * included. If an overflow entry cannot be allocated on the way the old
+ * arrays are put back untouched.
+ */
+static int cuckoo_resize(struct cuckoo_table *ct, size_t nbuckets)
+{
+    struct cuckoo_bucket *old_buckets = ct->buckets;
+    struct cuckoo_aux *old_aux = ct->aux;
+    struct overflow old_ovf = ct->ovf;
+    size_t old_n = ct->nbuckets, old_secondary = ct->secondary, b, i;
+    unsigned long long start = table_now_ns();
+    int w;
+
+    if(cuckoo_alloc(ct, nbuckets)) {
+        ct->buckets = old_buckets;
+        ct->aux = old_aux;
+        return -1;
+    }
+    memset(&ct->ovf, 0, sizeof(ct->ovf));
+    ct->secondary = 0;
+    ct->grows++;
+
+    for(b = 0; b < old_n; b++) {
+        for(w = 0; w < CUCKOO_WAYS; w++) {
+            size_t s = b * CUCKOO_WAYS + w;
+            if(old_buckets[b].key[w] && cuckoo_place(ct, old_buckets[b].hash[w], old_buckets[b].key[w],
+                                                     old_aux[s].keylen, old_aux[s].data) < 0)
+                goto fail;
+        }
+    }
+    for(i = 0; i < old_ovf.n; i++) {
+        if(cuckoo_place(ct, old_ovf.e[i].hash, old_ovf.e[i].key, old_ovf.e[i].keylen, old_ovf.e[i].data) < 0)
+            goto fail;
+    }
+
+    free(old_buckets);
+    free(old_aux);
+    free(old_ovf.e);
+    ct->base.grow_ns += table_now_ns() - start;
+    return 0;
+
+fail:
+    free(ct->buckets);
+    free(ct->aux);
+    free(ct->ovf.e);
+    ct->buckets = old_buckets;
+    ct->aux = old_aux;
+    ct->nbuckets = old_n;
+    ct->ovf = old_ovf;
+    ct->secondary = old_secondary;
+    ct->grows--;
+    return -1;
+}
+
+static int cuckoo_grow(struct cuckoo_table *ct)
+{
+    return cuckoo_resize(ct, ct->nbuckets << ct->grow_shift);
+}
+
+static int cuckoo_reserve(table_t t, size_t n)
+{
+    struct cuckoo_table *ct = t;
+    size_t nbuckets = ct->nbuckets;
+
+    while((double)(ct->elements + n) / (nbuckets * CUCKOO_WAYS) > ct->max_load)
+        nbuckets *= 2;
+    return nbuckets == ct->nbuckets ? 0 : cuckoo_resize(ct, nbuckets);
+}
+
+static int cuckoo_insert(table_t t, void *key, size_t keylen, void *data)
+{
+    struct cuckoo_table *ct = t;
+    unsigned long hash = ct->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t s;
+    int ret;
+
+    if((s = cuckoo_search(ct, hash, ct->cmp, key, keylen)) >= 0) {
+        ct->aux[s].data = data;
+        return 0;
+    }
+    if(ct->ovf.n && (oe = overflow_find(&ct->ovf, ct->cmp, hash, key, keylen))) {
+        oe->data = data;
+        return 0;
+    }
+
+    if((double)ct->elements / (ct->nbuckets * CUCKOO_WAYS) > ct->max_load && cuckoo_grow(ct))
+        return -1;
+
+    ret = cuckoo_place(ct, hash, key, keylen, data);
+    if(ret < 0)
+        return -1;
+    ct->elements++;
+
+    /* A failed eviction chain at reasonable load means the table is
+     * genuinely full; at low load it is a hash collision pile-up that
+     * growing would not fix, so the entry stays in overflow. If the
+     * grow fails the key is taken back out, so -1 still means the table
+     * is as it was before the call.
+     */
+    if(ret > 0 && (double)ct->elements / (ct->nbuckets * CUCKOO_WAYS) > CUCKOO_MIN_GROW_LOAD
+       && cuckoo_grow(ct)) {
+        if((s = cuckoo_search(ct, hash, ct->cmp, key, keylen)) >= 0)
+            clear_slot(ct, s / CUCKOO_WAYS, s % CUCKOO_WAYS);
+        else
+            overflow_del(&ct->ovf, overflow_find(&ct->ovf, ct->cmp, hash, key, keylen));
+        ct->elements--;
+        return -1;
+    }
+    return 0;
+}
+
+static int cuckoo_get(table_t t, void *key, size_t keylen, void **data_ptr)
+{
+    struct cuckoo_table *ct = t;
+    unsigned long hash = ct->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t s = cuckoo_lookup(ct, hash, ct->cmp, key, keylen, &oe);
+
+    if(s >= 0) {
+        *data_ptr = ct->aux[s].data;
+        return 0;
+    }
+    if(oe) {
+        *data_ptr = oe->data;
+        return 0;
+    }
+    *data_ptr = NULL;
+    return -1;
+}
+
+static int cuckoo_remove(table_t t, void *key, size_t keylen)
+{
+    struct cuckoo_table *ct = t;
+    unsigned long hash = ct->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t s = cuckoo_lookup(ct, hash, ct->cmp, key, keylen, &oe);
+
+    if(s >= 0) {
+        clear_slot(ct, s / CUCKOO_WAYS, s % CUCKOO_WAYS);
+    } else if(oe) {
+        overflow_del(&ct->ovf, oe);
+    } else {
+        return -1;
+    }
+    ct->elements--;
+    return 0;
+}
+
+static void *cuckoo_fetch(struct cuckoo_table *ct, void *key, size_t keylen, int want_key)
+{
+    unsigned long hash = ct->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t s = cuckoo_lookup(ct, hash, ct->cmp, key, keylen, &oe);
+
+    if(s >= 0)
+        return want_key ? ct->buckets[s / CUCKOO_WAYS].key[s % CUCKOO_WAYS] : ct->aux[s].data;
+    if(oe)
+        return want_key ? oe->key : oe->data;
+    return NULL;
+}
+
+static void *cuckoo_fetch_key(table_t t, void *key, size_t keylen)
+{
+    return cuckoo_fetch(t, key, keylen, 1);
+}
+
+static void *cuckoo_fetch_val(table_t t, void *key, size_t keylen)
+{
+    return cuckoo_fetch(t, key, keylen, 0);
+}
+
+static int cuckoo_iter(table_t t, iter_func f, void *arg)
+{
+    struct cuckoo_table *ct = t;
+    size_t s = 0, i = 0;
+    int ret = 0;
+
+    for(; s < ct->nbuckets * CUCKOO_WAYS; s++) {
+        void *key = ct->buckets[s / CUCKOO_WAYS].key[s % CUCKOO_WAYS];
+        if(key && (ret = f(arg, key, ct->aux[s].keylen, ct->aux[s].data)) != 0)
+            return ret;
+    }
+    for(; i < ct->ovf.n; i++) {
+        if((ret = f(arg, ct->ovf.e[i].key, ct->ovf.e[i].keylen, ct->ovf.e[i].data)) != 0)
+            return ret;
+    }
+    return 0;
+}
+
+static size_t cuckoo_erase_if(table_t t, iter_func pred, void *arg, int shrink)
+{
+    struct cuckoo_table *ct = t;
+    size_t s = 0, i, removed = 0, nbuckets = CUCKOO_BUCKETS_DEFAULT;
+
+    for(; s < ct->nbuckets * CUCKOO_WAYS; s++) {
+        void *key = ct->buckets[s / CUCKOO_WAYS].key[s % CUCKOO_WAYS];
+        if(key && pred(arg, key, ct->aux[s].keylen, ct->aux[s].data)) {
+            clear_slot(ct, s / CUCKOO_WAYS, s % CUCKOO_WAYS);
+            removed++;
+        }
+    }
+    /* overflow_del moves the last entry into the hole, so look again */
+    for(i = 0; i < ct->ovf.n;) {
+        struct overflow_entry *oe = &ct->ovf.e[i];
+        if(pred(arg, oe->key, oe->keylen, oe->data)) {
+            overflow_del(&ct->ovf, oe);
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    ct->elements -= removed;
+
+    if(shrink) {
+        while((double)ct->elements / (nbuckets * CUCKOO_WAYS) > ct->max_load / 2)
+            nbuckets *= 2;
+        if(nbuckets < ct->nbuckets)
+            cuckoo_resize(ct, nbuckets);
+    }
+    return removed;
+}
+
+/* Probe weight counts buckets read: 1 for the first bucket, 2 for the
+ * alternate, 3 for overflow entries (both buckets plus the list)
+ */
+static int cuckoo_get_stats(table_t t, struct table_stats *st)
+{
+    struct cuckoo_table *ct = t;
+
+    memset(st, 0, sizeof(*st));
+    st->size = ct->nbuckets * CUCKOO_WAYS;
+    st->elements = ct->elements;
+    st->memory = sizeof(*ct) + ct->nbuckets * (sizeof(*ct->buckets) + CUCKOO_WAYS * sizeof(*ct->aux)) +
+                 ct->ovf.cap * sizeof(*ct->ovf.e);
+    st->totalweight = ct->elements + ct->secondary + 2 * ct->ovf.n;
+    st->maxprobe = ct->ovf.n ? 3 : ct->secondary ? 2 : ct->elements ? 1 : 0;
+    st->grows = ct->grows;
+    return 0;
+}
+
+static void cuckoo_probe_counts(table_t t, unsigned long *counts, size_t n)
+{
+    struct cuckoo_table *ct = t;
+
+    counts[MIN_PROBE(1, n)] += ct->elements - ct->secondary - ct->ovf.n;
+    counts[MIN_PROBE(2, n)] += ct->secondary;
+    counts[MIN_PROBE(3, n)] += ct->ovf.n;
+}
+
+static size_t cuckoo_dump_slots(table_t t, struct table_slot *slots, size_t n)
+{
+    struct cuckoo_table *ct = t;
+    size_t b = 0, s;
+    int w;
+
+    if(n < ct->nbuckets * CUCKOO_WAYS)
+        return ct->nbuckets * CUCKOO_WAYS;
+    for(; b < ct->nbuckets; b++) {
+        for(w = 0; w < CUCKOO_WAYS; w++) {
+            s = b * CUCKOO_WAYS + w;
+            slots[s].hash = ct->buckets[b].key[w] ? ct->buckets[b].hash[w] : 0;
+            slots[s].state = ct->buckets[b].key[w] ? TABLE_SLOT_ALIVE : TABLE_SLOT_EMPTY;
+            slots[s].probe = !ct->buckets[b].key[w] ? 0 : b == bucket1(ct, slots[s].hash) ? 1 : 2;
+        }
+    }
+    return ct->nbuckets * CUCKOO_WAYS;
+}
+
+static int cuckoo_find(table_t t, unsigned long hash, cmp_func cmp, void *key, size_t keylen, void **data_ptr)
+{
+    struct cuckoo_table *ct = t;
+    struct overflow_entry *oe;
+    ssize_t s = cuckoo_lookup(ct, hash, cmp, key, keylen, &oe);
+
+    if(s >= 0) {
+        *data_ptr = ct->aux[s].data;
+        return 0;
+    }
+    if(oe) {
+        *data_ptr = oe->data;
+        return 0;
+    }
+    *data_ptr = NULL;
+    return -1;
+}
+
+static int cuckoo_key_probes(table_t t, void *key, size_t keylen)
+{
+    struct cuckoo_table *ct = t;
+    unsigned long hash = ct->hash(key, keylen);
+    ssize_t s = cuckoo_search(ct, hash, ct->cmp, key, keylen);
+
+    if(s >= 0)
+        return s / CUCKOO_WAYS == bucket1(ct, hash) ? 1 : 2;
+    if(ct->ovf.n && overflow_find(&ct->ovf, ct->cmp, hash, key, keylen))
+        return 3;
+    return -1;
+}
+
+static void cuckoo_print_stats(table_t t)
+{
+    struct cuckoo_table *ct = t;
+    struct table_stats st;
+
+    cuckoo_get_stats(t, &st);
+    printf("Table Diagnostics (cuckoo)\n");
+    printf("--------------------------\n");
+    printf("Table Size: %lu, Elements %lu, Load Factor: %f\n", st.size, st.elements, (float)st.elements/(float)st.size);
+    printf("Alternate bucket: %lu, Overflow: %lu, Grows: %lu\n", ct->secondary, ct->ovf.n, ct->grows);
+}
+
+static table_t cuckoo_clone(table_t t)
+{
+    struct cuckoo_table *ct = t, *c = malloc(sizeof(*c));
+    if(!c)
+        return NULL;
+
+    memcpy(c, ct, sizeof(*c));
+    c->buckets = bucket_array(ct->nbuckets);
+    c->aux = malloc(ct->nbuckets * CUCKOO_WAYS * sizeof(*c->aux));
+    if(!c->buckets || !c->aux || overflow_copy(&c->ovf, &ct->ovf)) {
+        free(c->buckets);
+        free(c->aux);
+        free(c);
+        return NULL;
+    }
+    memcpy(c->buckets, ct->buckets, ct->nbuckets * sizeof(*c->buckets));
+    memcpy(c->aux, ct->aux, ct->nbuckets * CUCKOO_WAYS * sizeof(*c->aux));
+    return c;
+}
+
+static void cuckoo_free(table_t t)
+{
+    struct cuckoo_table *ct = t;
+    free(ct->buckets);
+    free(ct->aux);
+    free(ct->ovf.e);
+    free(ct);
+}
+
+table_t cuckoo_new(const struct table_config *cfg)
+{
+    struct cuckoo_table *ct = calloc(1, sizeof(*ct));
+    if(!ct)
+        return NULL;
+
+    if(cuckoo_alloc(ct, CUCKOO_BUCKETS_DEFAULT)) {
+        free(ct);
+        return NULL;
+    }
+    ct->base.ops = &cuckoo_ops;
+    ct->base.engine = TABLE_ENGINE_CUCKOO;
+    ct->hash = cfg->hash;
+    ct->cmp = cfg->cmp;
+    ct->max_load = cfg->max_load ? cfg->max_load : CUCKOO_MAX_LOAD_FACTOR;
+    ct->grow_shift = table_grow_shift(cfg->growth ? cfg->growth : 2);
+    ct->rng = 0x2545f4914f6cdd1dUL;
+    return ct;
+}
+
+static const struct table_ops cuckoo_ops = {
+    .insert = cuckoo_insert,
+    .get = cuckoo_get,
+    .remove = cuckoo_remove,
+    .iter = cuckoo_iter,
+    .fetch_key = cuckoo_fetch_key,
+    .fetch_val = cuckoo_fetch_val,
+    .print_stats = cuckoo_print_stats,
+    .get_stats = cuckoo_get_stats,
+    .free = cuckoo_free,
+    .reserve = cuckoo_reserve,
+    .clone = cuckoo_clone,
+    .probe_counts = cuckoo_probe_counts,
+    .key_probes = cuckoo_key_probes,
+    .find = cuckoo_find,
+    .dump_slots = cuckoo_dump_slots,
+    .erase_if = cuckoo_erase_if,
+};
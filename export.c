@@ -0,0 +1,179 @@
+/* Columnar bulk export.
+ *
+ * Fills caller arrays with one column per field, in the layout Arrow
+ * uses for a LargeBinary column: int64 offsets (rows + 1 of them) into
+ * one key blob. Hashes and values are plain arrays alongside.
+ *
+ * Robin hood tables are exported straight from the slot array in two
+ * passes, both of which can be split over threads: the first sizes each
+ * slot range (rows and key bytes), a prefix sum turns those into write
+ * positions, and the second copies. Other engines go through table_iter.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "table_internal.h"
+
+struct part {
+    struct table *ta;
+    struct table_columns *cols;
+    size_t lo, hi;          /* slot range */
+    size_t rows, bytes;     /* sized in pass one */
+    size_t row0, byte0;     /* where pass two starts writing */
+    int fill;
+};
+
+struct generic {
+    struct table_base *tb;
+    struct table_columns *cols;
+    size_t rows, bytes;
+    int fill;
+};
+
+static void put_row(struct table_columns *c, size_t row, size_t byte, unsigned long hash,
+                    void *key, size_t keylen, void *data)
+{
+    if(c->hashes)
+        c->hashes[row] = hash;
+    if(c->values)
+        c->values[row] = data;
+    if(c->keys) {
+        c->offsets[row] = byte;
+        memcpy(c->keys + byte, key, keylen);
+    }
+}
+
+static void *part_run(void *arg)
+{
+    struct part *p = arg;
+    struct entry *e = p->ta->table;
+    size_t pos = p->lo, row = p->row0, byte = p->byte0;
+
+    if(!p->fill) {
+        for(; (pos = rh_next_alive(p->ta, pos)) < p->hi; pos++) {
+            p->rows++;
+            p->bytes += e[pos].keylen;
+        }
+        return NULL;
+    }
+
+    for(; (pos = rh_next_alive(p->ta, pos)) < p->hi; pos++) {
+        put_row(p->cols, row++, byte, e[pos].hash, e[pos].key, e[pos].keylen, e[pos].data);
+        byte += e[pos].keylen;
+    }
+    return NULL;
+}
+
+/* One pass over every part, parts after the first on their own threads.
+ * A part whose thread fails to start runs on the caller.
+ */
+static void run_parts(struct part *p, pthread_t *tid, unsigned int n)
+{
+    unsigned int i, started = 0;
+
+    for(i = 1; i < n; i++, started++) {
+        if(pthread_create(&tid[i], NULL, part_run, &p[i]))
+            break;
+    }
+    part_run(&p[0]);
+    for(i = 1; i <= started; i++)
+        pthread_join(tid[i], NULL);
+    for(i = started + 1; i < n; i++)
+        part_run(&p[i]);
+}
+
+static int rh_export(struct table *ta, struct table_columns *cols, unsigned int nthreads)
+{
+    size_t rows = 0, bytes = 0;
+    struct part *p;
+    pthread_t *tid;
+    unsigned int i;
+    int ret = 0;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > ta->size / 1024 + 1)
+        nthreads = ta->size / 1024 + 1;
+
+    p = calloc(nthreads, sizeof(*p));
+    tid = calloc(nthreads, sizeof(*tid));
+    if(!p || !tid) {
+        free(p);
+        free(tid);
+        return -1;
+    }
+
+    for(i = 0; i < nthreads; i++) {
+        p[i].ta = ta;
+        p[i].cols = cols;
+        p[i].lo = ta->size * i / nthreads;
+        p[i].hi = ta->size * (i + 1) / nthreads;
+    }
+    run_parts(p, tid, nthreads);
+
+    for(i = 0; i < nthreads; i++) {
+        p[i].row0 = rows;
+        p[i].byte0 = bytes;
+        p[i].fill = 1;
+        rows += p[i].rows;
+        bytes += p[i].bytes;
+    }
+
+    if(rows > cols->rows || (cols->keys && bytes > cols->key_bytes)) {
+        ret = -1;
+    } else {
+        run_parts(p, tid, nthreads);
+        if(cols->keys)
+            cols->offsets[rows] = bytes;
+    }
+    cols->rows = rows;
+    cols->key_bytes = bytes;
+
+    free(p);
+    free(tid);
+    return ret;
+}
+
+static int generic_visit(void *arg, void *key, size_t keylen, void *data)
+{
+    struct generic *g = arg;
+
+    if(g->fill)
+        put_row(g->cols, g->rows, g->bytes, g->tb->hash(key, keylen), key, keylen, data);
+    g->rows++;
+    g->bytes += keylen;
+    return 0;
+}
+
+static int generic_export(struct table_base *tb, struct table_columns *cols)
+{
+    struct generic g = { tb, cols, 0, 0, 0 };
+    int ret = 0;
+
+    table_iter(tb, generic_visit, &g);
+    if(g.rows > cols->rows || (cols->keys && g.bytes > cols->key_bytes)) {
+        ret = -1;
+    } else {
+        g.rows = g.bytes = 0;
+        g.fill = 1;
+        table_iter(tb, generic_visit, &g);
+        if(cols->keys)
+            cols->offsets[g.rows] = g.bytes;
+    }
+    cols->rows = g.rows;
+    cols->key_bytes = g.bytes;
+    return ret;
+}
+
+int table_export_columns(table_t t, struct table_columns *cols, unsigned int nthreads)
+{
+    struct table_base *tb = t;
+
+    if(cols->keys && !cols->offsets)
+        return -1;
+    if(tb->engine == TABLE_ENGINE_ROBIN_HOOD)
+        return rh_export(t, cols, nthreads);
+    return generic_export(tb, cols);
+}
@@ -0,0 +1,568 @@
+/* Hopscotch hashing engine.
+ *
+ * Every key lives within HOP_RANGE slots of its home slot, and each home
+ * slot keeps a bitmap of which of those neighbours hold its keys, so a
+ * lookup only inspects the set bits of one bitmap. Inserts linearly probe
+ * for an empty slot and then hop it backwards into the neighbourhood by
+ * displacing entries that may legally move further from their own home.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "table_internal.h"
+
+#define HOP_RANGE 32
+#define HOP_SIZE_DEFAULT 512
+#define HOP_ADD_RANGE 1024
+#define HOP_MAX_LOAD_FACTOR 0.90
+#define HOP_MIN_GROW_LOAD 0.50
+
+struct hop_slot {
+    unsigned long hash;
+    void *key;
+    void *data;
+    size_t keylen;
+};
+
+struct hop_table {
+    struct table_base base;
+    struct hop_slot *slots;
+    uint32_t *hops;             /* bit i of hops[h]: slot h+i holds a key whose home is h */
+    size_t size;                /* power of two */
+    size_t elements;            /* including overflow */
+    unsigned long totalweight;
+    unsigned int maxprobe;
+    unsigned long grows;
+    struct overflow ovf;
+    double max_load;
+    unsigned int grow_shift;    /* each grow multiplies the size by 2^grow_shift */
+    hash_func hash;
+    cmp_func cmp;
+};
+
+static const struct table_ops hop_ops;
+
+/* Home slot. The size is a power of two, so fold the high bits of the
+ * hash into the low ones first (murmur3 finaliser); djb2's low bits alone
+ * cluster badly on similar keys
+ */
+static size_t hop_home(struct hop_table *ht, unsigned long hash)
+{
+    unsigned long h = hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h & (ht->size - 1);
+}
+
+static size_t hop_dist(struct hop_table *ht, size_t from, size_t to)
+{
+    return (to - from) & (ht->size - 1);
+}
+
+static ssize_t hop_search(struct hop_table *ht, unsigned long hash, cmp_func cmp, void *key, size_t keylen)
+{
+    size_t home = hop_home(ht, hash);
+    uint32_t bits = ht->hops[home];
+
+    while(bits) {
+        size_t pos = (home + __builtin_ctz(bits)) & (ht->size - 1);
+        struct hop_slot *s = &ht->slots[pos];
+        if(s->hash == hash && !cmp(key, s->key, keylen))
+            return pos;
+        bits &= bits - 1;
+    }
+    return -1;
+}
+
+/* Slots read by a lookup that ended at `pos` or overflow entry `oe`: the
+ * neighbours the home bitmap sent it to, then the overflow list
+ */
+static void hop_trace_probes(struct hop_table *ht, unsigned long hash, void *key, size_t keylen,
+                             ssize_t pos, struct overflow_entry *oe)
+{
+    size_t home = hop_home(ht, hash);
+    uint32_t bits = ht->hops[home];
+    unsigned int probes, limit = ht->base.trace.probe_threshold;
+
+    if(pos >= 0)
+        probes = __builtin_popcount(bits & ((2u << hop_dist(ht, home, pos)) - 1));
+    else
+        probes = __builtin_popcount(bits) + (oe ? oe - ht->ovf.e + 1 : ht->ovf.n);
+    if(limit && probes > limit)
+        table_trace_fire(&ht->base, TABLE_TRACE_LONG_PROBE, key, keylen, hash, probes, 0);
+}
+
+/* Slot holding the key, or -1 with *oe set to its overflow entry (NULL
+ * when absent). The lookup behind get, remove, fetch and find.
+ */
+static ssize_t hop_lookup(struct hop_table *ht, unsigned long hash, cmp_func cmp, void *key, size_t keylen,
+                          struct overflow_entry **oe)
+{
+    ssize_t pos = hop_search(ht, hash, cmp, key, keylen);
+
+    *oe = NULL;
+    if(pos < 0 && ht->ovf.n)
+        *oe = overflow_find(&ht->ovf, cmp, hash, key, keylen);
+    if(TRACE_ON(&ht->base))
+        hop_trace_probes(ht, hash, key, keylen, pos, *oe);
+    return pos;
+}
+
+/* Find an entry in the HOP_RANGE-1 slots before `free` that may move
+ * into it, move it, and return the slot it vacated. -1 if none can move.
+ */
+static ssize_t hop_closer(struct hop_table *ht, size_t free)
+{
+    size_t mask = ht->size - 1, d;
+
+    for(d = HOP_RANGE - 1; d > 0; d--) {
+        size_t home = (free - d) & mask;
+        uint32_t bits = ht->hops[home] & ((1u << d) - 1);
+        if(bits) {
+            int off = __builtin_ctz(bits);
+            size_t from = (home + off) & mask;
+            ht->slots[free] = ht->slots[from];
+            ht->slots[from].key = NULL;
+            ht->hops[home] = (ht->hops[home] & ~(1u << off)) | (1u << d);
+            ht->totalweight += d - off;
+            ht->maxprobe = d + 1 > ht->maxprobe ? d + 1 : ht->maxprobe;
+            return from;
+        }
+    }
+    return -1;
+}
+
+/* Place a key known to be absent. Returns 1 if it went to overflow
+ * instead, -1 on allocation failure.
+ */
+static int hop_place(struct hop_table *ht, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    size_t mask = ht->size - 1, home = hop_home(ht, hash), d = 0, limit;
+    ssize_t free;
+
+    limit = ht->size < HOP_ADD_RANGE ? ht->size : HOP_ADD_RANGE;
+    while(d < limit && ht->slots[(home + d) & mask].key)
+        d++;
+    if(d == limit)
+        goto spill;
+
+    free = (home + d) & mask;
+    while(d >= HOP_RANGE) {
+        if((free = hop_closer(ht, free)) < 0)
+            goto spill;
+        d = hop_dist(ht, home, free);
+    }
+
+    ht->slots[free].hash = hash;
+    ht->slots[free].key = key;
+    ht->slots[free].data = data;
+    ht->slots[free].keylen = keylen;
+    ht->hops[home] |= 1u << d;
+    ht->totalweight += d + 1;
+    ht->maxprobe = d + 1 > ht->maxprobe ? d + 1 : ht->maxprobe;
+    return 0;
+
+spill:
+    return overflow_add(&ht->ovf, hash, key, keylen, data) ? -1 : 1;
+}
+
+static int hop_alloc(struct hop_table *ht, size_t size)
+{
+    ht->slots = calloc(size, sizeof(*ht->slots));
+    ht->hops = calloc(size, sizeof(*ht->hops));
+    if(!ht->slots || !ht->hops) {
+        free(ht->slots);
+        free(ht->hops);
+        return -1;
+    }
+    ht->size = size;
+    return 0;
+}
+
+/* Rebuild at size slots and re-place everything, overflow included. If
+ * an overflow entry cannot be allocated on the way the old arrays are put
+ * back untouched.
+ */
+static int hop_resize(struct hop_table *ht, size_t size)
+{
+    struct hop_slot *old_slots = ht->slots;
+    uint32_t *old_hops = ht->hops;
+    struct overflow old_ovf = ht->ovf;
+    size_t old_size = ht->size, i;
+    unsigned long old_weight = ht->totalweight;
+    unsigned int old_maxprobe = ht->maxprobe;
+    unsigned long long start = table_now_ns();
+
+    if(hop_alloc(ht, size)) {
+        ht->slots = old_slots;
+        ht->hops = old_hops;
+        return -1;
+    }
+    memset(&ht->ovf, 0, sizeof(ht->ovf));
+    ht->totalweight = 0;
+    ht->maxprobe = 0;
+    ht->grows++;
+
+    for(i = 0; i < old_size; i++) {
+        if(old_slots[i].key && hop_place(ht, old_slots[i].hash, old_slots[i].key,
+                                         old_slots[i].keylen, old_slots[i].data) < 0)
+            goto fail;
+    }
+    for(i = 0; i < old_ovf.n; i++) {
+        if(hop_place(ht, old_ovf.e[i].hash, old_ovf.e[i].key, old_ovf.e[i].keylen, old_ovf.e[i].data) < 0)
+            goto fail;
+    }
+
+    free(old_slots);
+    free(old_hops);
+    free(old_ovf.e);
+    ht->base.grow_ns += table_now_ns() - start;
+    return 0;
+
+fail:
+    free(ht->slots);
+    free(ht->hops);
+    free(ht->ovf.e);
+    ht->slots = old_slots;
+    ht->hops = old_hops;
+    ht->size = old_size;
+    ht->ovf = old_ovf;
+    ht->totalweight = old_weight;
+    ht->maxprobe = old_maxprobe;
+    ht->grows--;
+    return -1;
+}
+
+static int hop_grow(struct hop_table *ht)
+{
+    return hop_resize(ht, ht->size << ht->grow_shift);
+}
+
+static int hop_reserve(table_t t, size_t n)
+{
+    struct hop_table *ht = t;
+    size_t size = ht->size;
+
+    while((double)(ht->elements + n) / size > ht->max_load)
+        size *= 2;
+    return size == ht->size ? 0 : hop_resize(ht, size);
+}
+
+static int hop_insert(table_t t, void *key, size_t keylen, void *data)
+{
+    struct hop_table *ht = t;
+    unsigned long hash = ht->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t pos;
+    int ret;
+
+    if((pos = hop_search(ht, hash, ht->cmp, key, keylen)) >= 0) {
+        ht->slots[pos].data = data;
+        return 0;
+    }
+    if(ht->ovf.n && (oe = overflow_find(&ht->ovf, ht->cmp, hash, key, keylen))) {
+        oe->data = data;
+        return 0;
+    }
+
+    if((double)ht->elements / ht->size > ht->max_load && hop_grow(ht))
+        return -1;
+
+    ret = hop_place(ht, hash, key, keylen, data);
+    if(ret < 0)
+        return -1;
+    ht->elements++;
+
+    /* Same policy as cuckoo: only grow when a spill is due to load, and
+     * take the key back out if that grow fails
+     */
+    if(ret > 0 && (double)ht->elements / ht->size > HOP_MIN_GROW_LOAD && hop_grow(ht)) {
+        if((pos = hop_search(ht, hash, ht->cmp, key, keylen)) >= 0) {
+            size_t home = hop_home(ht, hash), d = hop_dist(ht, home, pos);
+            ht->hops[home] &= ~(1u << d);
+            ht->slots[pos].key = NULL;
+            ht->totalweight -= d + 1;
+        } else {
+            overflow_del(&ht->ovf, overflow_find(&ht->ovf, ht->cmp, hash, key, keylen));
+        }
+        ht->elements--;
+        return -1;
+    }
+    return 0;
+}
+
+static int hop_get(table_t t, void *key, size_t keylen, void **data_ptr)
+{
+    struct hop_table *ht = t;
+    unsigned long hash = ht->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t pos = hop_lookup(ht, hash, ht->cmp, key, keylen, &oe);
+
+    if(pos >= 0) {
+        *data_ptr = ht->slots[pos].data;
+        return 0;
+    }
+    if(oe) {
+        *data_ptr = oe->data;
+        return 0;
+    }
+    *data_ptr = NULL;
+    return -1;
+}
+
+static int hop_remove(table_t t, void *key, size_t keylen)
+{
+    struct hop_table *ht = t;
+    unsigned long hash = ht->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t pos = hop_lookup(ht, hash, ht->cmp, key, keylen, &oe);
+
+    if(pos >= 0) {
+        size_t home = hop_home(ht, hash), d = hop_dist(ht, home, pos);
+        ht->hops[home] &= ~(1u << d);
+        ht->slots[pos].key = NULL;
+        ht->totalweight -= d + 1;
+    } else if(oe) {
+        overflow_del(&ht->ovf, oe);
+    } else {
+        return -1;
+    }
+    ht->elements--;
+    return 0;
+}
+
+static void *hop_fetch(struct hop_table *ht, void *key, size_t keylen, int want_key)
+{
+    unsigned long hash = ht->hash(key, keylen);
+    struct overflow_entry *oe;
+    ssize_t pos = hop_lookup(ht, hash, ht->cmp, key, keylen, &oe);
+
+    if(pos >= 0)
+        return want_key ? ht->slots[pos].key : ht->slots[pos].data;
+    if(oe)
+        return want_key ? oe->key : oe->data;
+    return NULL;
+}
+
+static void *hop_fetch_key(table_t t, void *key, size_t keylen)
+{
+    return hop_fetch(t, key, keylen, 1);
+}
+
+static void *hop_fetch_val(table_t t, void *key, size_t keylen)
+{
+    return hop_fetch(t, key, keylen, 0);
+}
+
+static int hop_iter(table_t t, iter_func f, void *arg)
+{
+    struct hop_table *ht = t;
+    size_t i = 0;
+    int ret = 0;
+
+    for(; i < ht->size; i++) {
+        struct hop_slot *s = &ht->slots[i];
+        if(s->key && (ret = f(arg, s->key, s->keylen, s->data)) != 0)
+            return ret;
+    }
+    for(i = 0; i < ht->ovf.n; i++) {
+        if((ret = f(arg, ht->ovf.e[i].key, ht->ovf.e[i].keylen, ht->ovf.e[i].data)) != 0)
+            return ret;
+    }
+    return 0;
+}
+
+static size_t hop_erase_if(table_t t, iter_func pred, void *arg, int shrink)
+{
+    struct hop_table *ht = t;
+    size_t i = 0, removed = 0, size = HOP_SIZE_DEFAULT;
+
+    for(; i < ht->size; i++) {
+        struct hop_slot *s = &ht->slots[i];
+        if(s->key && pred(arg, s->key, s->keylen, s->data)) {
+            size_t home = hop_home(ht, s->hash), d = hop_dist(ht, home, i);
+            ht->hops[home] &= ~(1u << d);
+            s->key = NULL;
+            ht->totalweight -= d + 1;
+            removed++;
+        }
+    }
+    /* overflow_del moves the last entry into the hole, so look again */
+    for(i = 0; i < ht->ovf.n;) {
+        struct overflow_entry *oe = &ht->ovf.e[i];
+        if(pred(arg, oe->key, oe->keylen, oe->data)) {
+            overflow_del(&ht->ovf, oe);
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    ht->elements -= removed;
+
+    if(shrink) {
+        while((double)ht->elements / size > ht->max_load / 2)
+            size *= 2;
+        if(size < ht->size)
+            hop_resize(ht, size);
+    }
+    return removed;
+}
+
+static int hop_get_stats(table_t t, struct table_stats *st)
+{
+    struct hop_table *ht = t;
+
+    memset(st, 0, sizeof(*st));
+    st->size = ht->size;
+    st->elements = ht->elements;
+    st->memory = sizeof(*ht) + ht->size * (sizeof(*ht->slots) + sizeof(*ht->hops)) +
+                 ht->ovf.cap * sizeof(*ht->ovf.e);
+    st->totalweight = ht->totalweight + (HOP_RANGE + 1) * ht->ovf.n;
+    st->maxprobe = ht->ovf.n ? HOP_RANGE + 1 : ht->maxprobe;
+    st->grows = ht->grows;
+    return 0;
+}
+
+static void hop_probe_counts(table_t t, unsigned long *counts, size_t n)
+{
+    struct hop_table *ht = t;
+    size_t i = 0, p;
+
+    for(; i < ht->size; i++) {
+        if(ht->slots[i].key) {
+            p = hop_dist(ht, hop_home(ht, ht->slots[i].hash), i) + 1;
+            counts[p < n ? p : n - 1]++;
+        }
+    }
+    p = HOP_RANGE + 1;
+    counts[p < n ? p : n - 1] += ht->ovf.n;
+}
+
+static size_t hop_dump_slots(table_t t, struct table_slot *slots, size_t n)
+{
+    struct hop_table *ht = t;
+    size_t i = 0;
+
+    if(n < ht->size)
+        return ht->size;
+    for(; i < ht->size; i++) {
+        struct hop_slot *s = &ht->slots[i];
+        slots[i].hash = s->key ? s->hash : 0;
+        slots[i].probe = s->key ? hop_dist(ht, hop_home(ht, s->hash), i) + 1 : 0;
+        slots[i].state = s->key ? TABLE_SLOT_ALIVE : TABLE_SLOT_EMPTY;
+    }
+    return ht->size;
+}
+
+static int hop_find(table_t t, unsigned long hash, cmp_func cmp, void *key, size_t keylen, void **data_ptr)
+{
+    struct hop_table *ht = t;
+    struct overflow_entry *oe;
+    ssize_t pos = hop_lookup(ht, hash, cmp, key, keylen, &oe);
+
+    if(pos >= 0) {
+        *data_ptr = ht->slots[pos].data;
+        return 0;
+    }
+    if(oe) {
+        *data_ptr = oe->data;
+        return 0;
+    }
+    *data_ptr = NULL;
+    return -1;
+}
+
+static int hop_key_probes(table_t t, void *key, size_t keylen)
+{
+    struct hop_table *ht = t;
+    unsigned long hash = ht->hash(key, keylen);
+    ssize_t pos = hop_search(ht, hash, ht->cmp, key, keylen);
+
+    if(pos >= 0)
+        return hop_dist(ht, hop_home(ht, hash), pos) + 1;
+    if(ht->ovf.n && overflow_find(&ht->ovf, ht->cmp, hash, key, keylen))
+        return HOP_RANGE + 1;
+    return -1;
+}
+
+static void hop_print_stats(table_t t)
+{
+    struct hop_table *ht = t;
+    struct table_stats st;
+
+    hop_get_stats(t, &st);
+    printf("Table Diagnostics (hopscotch)\n");
+    printf("-----------------------------\n");
+    printf("Table Size: %lu, Elements %lu, Load Factor: %f\n", st.size, st.elements, (float)st.elements/(float)st.size);
+    printf("Max Distance: %u, Overflow: %lu, Grows: %lu\n", ht->maxprobe, ht->ovf.n, ht->grows);
+}
+
+static table_t hop_clone(table_t t)
+{
+    struct hop_table *ht = t, *c = malloc(sizeof(*c));
+    if(!c)
+        return NULL;
+
+    memcpy(c, ht, sizeof(*c));
+    c->slots = malloc(ht->size * sizeof(*c->slots));
+    c->hops = malloc(ht->size * sizeof(*c->hops));
+    if(!c->slots || !c->hops || overflow_copy(&c->ovf, &ht->ovf)) {
+        free(c->slots);
+        free(c->hops);
+        free(c);
+        return NULL;
+    }
+    memcpy(c->slots, ht->slots, ht->size * sizeof(*c->slots));
+    memcpy(c->hops, ht->hops, ht->size * sizeof(*c->hops));
+    return c;
+}
+
+static void hop_free(table_t t)
+{
+    struct hop_table *ht = t;
+    free(ht->slots);
+    free(ht->hops);
+    free(ht->ovf.e);
+    free(ht);
+}
+
+table_t hopscotch_new(const struct table_config *cfg)
+{
+    struct hop_table *ht = calloc(1, sizeof(*ht));
+    if(!ht)
+        return NULL;
+
+    if(hop_alloc(ht, HOP_SIZE_DEFAULT)) {
+        free(ht);
+        return NULL;
+    }
+    ht->base.ops = &hop_ops;
+    ht->base.engine = TABLE_ENGINE_HOPSCOTCH;
+    ht->hash = cfg->hash;
+    ht->cmp = cfg->cmp;
+    ht->max_load = cfg->max_load ? cfg->max_load : HOP_MAX_LOAD_FACTOR;
+    ht->grow_shift = table_grow_shift(cfg->growth ? cfg->growth : 2);
+    return ht;
+}
+
+static const struct table_ops hop_ops = {
+    .insert = hop_insert,
+    .get = hop_get,
+    .remove = hop_remove,
+    .iter = hop_iter,
+    .fetch_key = hop_fetch_key,
+    .fetch_val = hop_fetch_val,
+    .print_stats = hop_print_stats,
+    .get_stats = hop_get_stats,
+    .free = hop_free,
+    .reserve = hop_reserve,
+    .clone = hop_clone,
+    .probe_counts = hop_probe_counts,
+    .key_probes = hop_key_probes,
+    .find = hop_find,
+    .dump_slots = hop_dump_slots,
+    .erase_if = hop_erase_if,
+};
@@ -0,0 +1,98 @@
+/* Lookups by multi-part keys.
+ *
+ * With the built-in hash and compare a key given as parts is never
+ * assembled: djb2 runs straight across the parts, and the engine's
+ * search compares through parts_cmp, which walks the parts against the
+ * stored key with the same strncmp semantics as the built-in compare
+ * (equal up to a shared NUL counts as equal). A table with its own hash
+ * or compare gets the parts concatenated, on the stack when they fit, as
+ * does a traced or sampled one so the hook and sampler see the whole key.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "table_internal.h"
+
+#define PARTS_STACK_KEY 256
+
+struct parts {
+    const struct table_keypart *p;
+    int n;
+};
+
+static unsigned long parts_hash(const struct table_keypart *p, int n)
+{
+    struct table_hasher hs;
+
+    table_hasher_init(&hs);
+    for(; n > 0; n--, p++)
+        table_hasher_update(&hs, p->base, p->len);
+    return table_hasher_final(&hs);
+}
+
+/* cmp_func over a struct parts; len is the total key length */
+static int parts_cmp(void *k1, void *k2, size_t len)
+{
+    struct parts *ps = k1;
+    const char *stored = k2;
+    const struct table_keypart *p = ps->p;
+    int i = 0, r;
+    (void)len;
+
+    for(; i < ps->n; i++, p++) {
+        if((r = strncmp(p->base, stored, p->len)))
+            return r;
+        if(memchr(p->base, '\0', p->len))
+            return 0;
+        stored += p->len;
+    }
+    return 0;
+}
+
+static size_t parts_len(const struct table_keypart *p, int n)
+{
+    size_t len = 0;
+    for(; n > 0; n--, p++)
+        len += p->len;
+    return len;
+}
+
+/* Concatenate the parts into stack when they fit, else a malloc'd buffer */
+static char *parts_join(const struct table_keypart *p, int n, size_t len, char *stack)
+{
+    char *key = len <= PARTS_STACK_KEY ? stack : malloc(len);
+    size_t off = 0;
+
+    if(!key)
+        return NULL;
+    for(; n > 0; n--, p++) {
+        memcpy(key + off, p->base, p->len);
+        off += p->len;
+    }
+    return key;
+}
+
+int table_get_parts(table_t t, const struct table_keypart *parts, int nparts, void **dataptr)
+{
+    struct table_base *tb = t;
+    size_t len = parts_len(parts, nparts);
+    char stack[PARTS_STACK_KEY], *key = NULL;
+    struct parts ps = { parts, nparts };
+    int fast = tb->hash == table_hash && tb->cmp == table_cmp;
+    int ret;
+
+    /* The fast path only needs the joined key to report to a trace hook
+     * or the sampler
+     */
+    if((!fast || TRACE_ON(tb) || tb->sampler) && !(key = parts_join(parts, nparts, len, stack))) {
+        *dataptr = NULL;
+        return -1;
+    }
+    if(fast)
+        ret = table_find_noted(tb, parts_hash(parts, nparts), parts_cmp, &ps, len, dataptr, key);
+    else
+        ret = table_get(t, key, len, dataptr);
+    if(key != stack)
+        free(key);
+    return ret;
+}
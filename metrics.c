@@ -0,0 +1,192 @@
+/* Prometheus text exposition of table statistics.
+ *
+ * Rendering is pure formatting into the caller's buffer: nothing here
+ * does I/O, so an exporter thread can call it and serve the result.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table_internal.h"
+
+#define PROBE_BUCKETS 9     /* le 1, 2, 4 ... 256, then +Inf */
+#define PROBE_COUNTS 257    /* exact counts up to 255, then everything longer */
+
+struct out {
+    char *buf;
+    size_t len;
+    size_t pos;             /* bytes the full output needs so far */
+};
+
+struct snap {
+    struct table_stats st;
+    unsigned long counts[PROBE_COUNTS];
+    int ok;
+};
+
+static void put(struct out *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(o->pos < o->len ? o->buf + o->pos : NULL,
+                  o->pos < o->len ? o->len - o->pos : 0, fmt, ap);
+    va_end(ap);
+    if(n > 0)
+        o->pos += n;
+}
+
+/* name{labels[,extra]} */
+static void series(struct out *o, const char *name, const char *labels, const char *extra)
+{
+    int l = labels && *labels, x = extra && *extra;
+
+    put(o, "%s", name);
+    if(l || x)
+        put(o, "{%s%s%s}", l ? labels : "", l && x ? "," : "", x ? extra : "");
+    put(o, " ");
+}
+
+static void family(struct out *o, const char *name, const char *type, const char *help)
+{
+    put(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+enum { M_ELEMENTS, M_CAPACITY, M_LOAD, M_MEMORY, M_GROWS, M_GROW_SECONDS, M_OPS, M_HITS, M_COUNT };
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} metrics[M_COUNT] = {
+    { "rh_table_elements", "gauge", "Live entries." },
+    { "rh_table_capacity", "gauge", "Allocated slots." },
+    { "rh_table_load_factor", "gauge", "Live entries per allocated slot." },
+    { "rh_table_memory_bytes", "gauge", "Bytes held by the table, excluding borrowed keys and values." },
+    { "rh_table_grows_total", "counter", "Table resizes." },
+    { "rh_table_grow_seconds_total", "counter", "Time spent resizing." },
+    { "rh_table_operations_total", "counter", "Insert, get and remove calls." },
+    { "rh_table_get_hits_total", "counter", "Gets that found their key." },
+};
+
+static void sample(struct out *o, int m, const char *labels, struct snap *s)
+{
+    struct table_stats *st = &s->st;
+
+    switch(m) {
+    case M_ELEMENTS:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%zu\n", st->elements);
+        break;
+    case M_CAPACITY:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%zu\n", st->size);
+        break;
+    case M_LOAD:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%g\n", st->size ? (double)st->elements / st->size : 0.0);
+        break;
+    case M_MEMORY:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%zu\n", st->memory);
+        break;
+    case M_GROWS:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%lu\n", st->grows);
+        break;
+    case M_GROW_SECONDS:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%.9f\n", st->grow_ns / 1e9);
+        break;
+    case M_OPS:
+        series(o, metrics[m].name, labels, "op=\"insert\"");
+        put(o, "%lu\n", st->inserts);
+        series(o, metrics[m].name, labels, "op=\"get\"");
+        put(o, "%lu\n", st->gets);
+        series(o, metrics[m].name, labels, "op=\"remove\"");
+        put(o, "%lu\n", st->removes);
+        break;
+    case M_HITS:
+        series(o, metrics[m].name, labels, NULL);
+        put(o, "%lu\n", st->get_hits);
+        break;
+    }
+}
+
+static void probe_histogram(struct out *o, const char *labels, struct snap *s)
+{
+    unsigned long cum = 0;
+    size_t p = 0, le = 1;
+    int b = 0;
+    char extra[32];
+
+    for(; b < PROBE_BUCKETS; b++, le *= 2) {
+        for(; p <= le && p < PROBE_COUNTS; p++)
+            cum += s->counts[p];
+        snprintf(extra, sizeof(extra), "le=\"%zu\"", le);
+        series(o, "rh_table_probe_length_bucket", labels, extra);
+        put(o, "%lu\n", cum);
+    }
+    for(; p < PROBE_COUNTS; p++)
+        cum += s->counts[p];
+    series(o, "rh_table_probe_length_bucket", labels, "le=\"+Inf\"");
+    put(o, "%lu\n", cum);
+    series(o, "rh_table_probe_length_sum", labels, NULL);
+    put(o, "%lu\n", s->st.totalweight);
+    series(o, "rh_table_probe_length_count", labels, NULL);
+    put(o, "%lu\n", cum);
+}
+
+/* Stats plus one pass over the slots for the probe histogram. The
+ * histogram sum is the stats probe weight, which every engine keeps exact.
+ */
+static void snapshot(table_t t, struct snap *s)
+{
+    struct table_base *tb = t;
+
+    memset(s, 0, sizeof(*s));
+    if(table_get_stats(t, &s->st))
+        return;
+    tb->ops->probe_counts(t, s->counts, PROBE_COUNTS);
+    s->ok = 1;
+}
+
+int table_metrics_prometheus_many(table_t *tables, const char **labels, size_t n, char *buf, size_t len)
+{
+    struct out o = { buf, len, 0 };
+    struct snap *s = malloc((n ? n : 1) * sizeof(*s));
+    size_t i;
+    int m;
+
+    if(buf && len)
+        buf[0] = '\0';
+    if(!s)
+        return -1;
+
+    for(i = 0; i < n; i++)
+        snapshot(tables[i], &s[i]);
+
+    for(m = 0; m < M_COUNT; m++) {
+        family(&o, metrics[m].name, metrics[m].type, metrics[m].help);
+        for(i = 0; i < n; i++) {
+            if(s[i].ok)
+                sample(&o, m, labels ? labels[i] : NULL, &s[i]);
+        }
+    }
+
+    family(&o, "rh_table_probe_length", "histogram", "Probe length of live entries.");
+    for(i = 0; i < n; i++) {
+        if(s[i].ok)
+            probe_histogram(&o, labels ? labels[i] : NULL, &s[i]);
+    }
+
+    free(s);
+    return o.pos;
+}
+
+int table_metrics_prometheus(table_t t, const char *labels, char *buf, size_t len)
+{
+    return table_metrics_prometheus_many(&t, &labels, 1, buf, len);
+}
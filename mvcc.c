@@ -0,0 +1,392 @@
+/* Multi-version tables for snapshot readers.
+ *
+ * The underlying table maps each key to a chain of versions, newest
+ * first. Every write commits as the next version number; a delete
+ * commits a dead version. A reader opens a snapshot (the current version
+ * number) and sees, for every key, the newest version at or below it.
+ *
+ * A batch (table_mvcc_apply) pushes all its versions under one number
+ * and only then bumps the version, so snapshots see all of it or none.
+ *
+ * Collection keeps, per chain, the newest version and whichever older
+ * versions some open snapshot still sees, and frees the rest. Only
+ * chains that picked up a second version or a delete can hold garbage,
+ * so those go on a dirty list and collection walks just that. With no
+ * snapshot open nothing older than the head is reachable, so every write
+ * collects straight away and the dirty list never holds more than the
+ * write's own chains.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+#define APPLY_INFLIGHT 8
+
+struct version {
+    unsigned long ver;
+    void *data;
+    int dead;
+    struct version *older;
+};
+
+struct chain {
+    void *key;                  /* owned copy, also the key in the table */
+    size_t keylen;
+    struct version *head;
+    int dirty;
+    struct chain *next_dirty;
+};
+
+struct snapshot {
+    unsigned long ver;
+    unsigned long refs;
+};
+
+struct mvcc {
+    table_t t;
+    unsigned long version;      /* last committed */
+    struct chain *dirty;
+    struct snapshot *snaps;
+    size_t nsnaps;
+    size_t snapcap;
+    unsigned long versions;     /* live version records */
+};
+
+mvcc_t table_mvcc_new(const struct table_config *cfg)
+{
+    struct table_config def = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL };
+    struct mvcc *m = calloc(1, sizeof(*m));
+
+    if(!m)
+        return NULL;
+    if(!(m->t = table_new_ex(cfg ? cfg : &def))) {
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+static void free_versions(struct mvcc *m, struct version *v)
+{
+    struct version *older;
+
+    for(; v; v = older) {
+        older = v->older;
+        free(v);
+        m->versions--;
+    }
+}
+
+static int free_chain(void *arg, void *key, size_t keylen, void *data)
+{
+    struct chain *c = data;
+    (void)key;
+    (void)keylen;
+
+    free_versions(arg, c->head);
+    free(c->key);
+    free(c);
+    return 0;
+}
+
+void table_mvcc_free(mvcc_t mv)
+{
+    struct mvcc *m = mv;
+
+    if(!m)
+        return;
+    table_iter(m->t, free_chain, m);
+    table_free(m->t);
+    free(m->snaps);
+    free(m);
+}
+
+static void mark_dirty(struct mvcc *m, struct chain *c)
+{
+    if(c->dirty)
+        return;
+    c->dirty = 1;
+    c->next_dirty = m->dirty;
+    m->dirty = c;
+}
+
+/* New empty chain for key, already in the table */
+static struct chain *new_chain(struct mvcc *m, void *key, size_t keylen)
+{
+    struct chain *c = calloc(1, sizeof(*c));
+
+    if(!c || !(c->key = malloc(keylen ? keylen : 1))) {
+        free(c);
+        return NULL;
+    }
+    memcpy(c->key, key, keylen);
+    c->keylen = keylen;
+    if(table_insert(m->t, c->key, keylen, c)) {
+        free(c->key);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void drop_chain(struct mvcc *m, struct chain *c)
+{
+    table_remove(m->t, c->key, c->keylen);
+    free_chain(m, c->key, c->keylen, c);
+}
+
+/* Push a version committed at ver. Nothing is visible to readers until
+ * m->version reaches ver. Deleting a key with no live version fails.
+ */
+static int push(struct mvcc *m, struct chain *c, void *data, int dead, unsigned long ver)
+{
+    struct version *v;
+
+    if(dead && (!c->head || c->head->dead))
+        return -1;
+    if(!(v = malloc(sizeof(*v))))
+        return -1;
+    v->ver = ver;
+    v->data = data;
+    v->dead = dead;
+    v->older = c->head;
+    c->head = v;
+    m->versions++;
+    return 0;
+}
+
+/* Undo the last push, dropping a chain the push created */
+static void pop(struct mvcc *m, struct chain *c)
+{
+    struct version *v = c->head;
+
+    c->head = v->older;
+    free(v);
+    m->versions--;
+    if(!c->head)
+        drop_chain(m, c);
+}
+
+static int write_one(struct mvcc *m, void *key, size_t keylen, void *data, int dead)
+{
+    struct chain *c;
+    void *cp;
+
+    if(table_get(m->t, key, keylen, &cp) == 0)
+        c = cp;
+    else if(dead || !(c = new_chain(m, key, keylen)))
+        return -1;
+
+    if(push(m, c, data, dead, m->version + 1)) {
+        if(!c->head)
+            drop_chain(m, c);
+        return -1;
+    }
+    if(c->head->older)
+        mark_dirty(m, c);
+    m->version++;
+    if(!m->nsnaps)
+        table_mvcc_gc(m);
+    return 0;
+}
+
+int table_mvcc_put(mvcc_t mv, void *key, size_t keylen, void *data)
+{
+    return write_one(mv, key, keylen, data, 0);
+}
+
+int table_mvcc_del(mvcc_t mv, void *key, size_t keylen)
+{
+    return write_one(mv, key, keylen, NULL, 1);
+}
+
+/* Look up the chains of ops[0..n) with up to APPLY_INFLIGHT lookups
+ * interleaved, so their probes overlap instead of stalling one by one
+ */
+static void resolve(struct mvcc *m, const struct table_mvcc_op *ops, size_t n, struct chain **cs)
+{
+    struct table_lookup l[APPLY_INFLIGHT];
+    int done[APPLY_INFLIGHT];
+    size_t i = 0, j, k, left;
+    void *cp;
+    int r;
+
+    for(; i < n; i += k) {
+        k = n - i < APPLY_INFLIGHT ? n - i : APPLY_INFLIGHT;
+        for(j = 0; j < k; j++) {
+            table_lookup_start(m->t, &l[j], ops[i + j].key, ops[i + j].keylen);
+            done[j] = 0;
+        }
+        for(left = k; left;) {
+            for(j = 0; j < k; j++) {
+                if(done[j] || (r = table_lookup_step(&l[j], &cp)) == TABLE_LOOKUP_PENDING)
+                    continue;
+                cs[i + j] = r ? NULL : cp;
+                done[j] = 1;
+                left--;
+            }
+        }
+    }
+}
+
+int table_mvcc_apply(mvcc_t mv, const struct table_mvcc_op *ops, size_t n)
+{
+    struct mvcc *m = mv;
+    struct chain **cs, *c;
+    size_t i = 0;
+    void *cp;
+    int dead;
+
+    if(n == 0)
+        return 0;
+    if(!(cs = malloc(n * sizeof(*cs))))
+        return -1;
+    resolve(m, ops, n, cs);
+
+    for(; i < n; i++) {
+        dead = ops[i].op == TABLE_MVCC_DEL;
+        /* absent before the batch, but an earlier op may have added it */
+        if(!(c = cs[i]) && table_get(m->t, ops[i].key, ops[i].keylen, &cp) == 0)
+            c = cp;
+        if(!c && (dead || !(c = new_chain(m, ops[i].key, ops[i].keylen))))
+            goto undo;
+        if(push(m, c, ops[i].data, dead, m->version + 1)) {
+            if(!c->head)
+                drop_chain(m, c);
+            goto undo;
+        }
+        cs[i] = c;
+    }
+
+    for(i = 0; i < n; i++)
+        if(cs[i]->head->older)
+            mark_dirty(m, cs[i]);
+    m->version++;
+    free(cs);
+    if(!m->nsnaps)
+        table_mvcc_gc(m);
+    return 0;
+
+undo:
+    while(i--)
+        pop(m, cs[i]);
+    free(cs);
+    return -1;
+}
+
+int table_mvcc_get(mvcc_t mv, void *key, size_t keylen, unsigned long snap, void **dataptr)
+{
+    struct mvcc *m = mv;
+    struct version *v;
+    void *cp;
+
+    *dataptr = NULL;
+    if(table_get(m->t, key, keylen, &cp))
+        return -1;
+    for(v = ((struct chain *)cp)->head; v && v->ver > snap; v = v->older)
+        ;
+    if(!v || v->dead)
+        return -1;
+    *dataptr = v->data;
+    return 0;
+}
+
+unsigned long table_mvcc_version(mvcc_t mv)
+{
+    struct mvcc *m = mv;
+    return m->version;
+}
+
+int table_snapshot_open(mvcc_t mv, unsigned long *snap)
+{
+    struct mvcc *m = mv;
+    struct snapshot *s;
+
+    if(m->nsnaps && m->snaps[m->nsnaps - 1].ver == m->version) {
+        m->snaps[m->nsnaps - 1].refs++;
+        *snap = m->version;
+        return 0;
+    }
+    if(m->nsnaps == m->snapcap) {
+        size_t cap = m->snapcap ? m->snapcap * 2 : 8;
+        if(!(s = realloc(m->snaps, cap * sizeof(*s))))
+            return -1;
+        m->snaps = s;
+        m->snapcap = cap;
+    }
+    /* versions only go up, so the array stays sorted oldest first */
+    m->snaps[m->nsnaps].ver = m->version;
+    m->snaps[m->nsnaps].refs = 1;
+    m->nsnaps++;
+    *snap = m->version;
+    return 0;
+}
+
+void table_snapshot_close(mvcc_t mv, unsigned long snap)
+{
+    struct mvcc *m = mv;
+    size_t i = 0;
+
+    for(; i < m->nsnaps; i++) {
+        if(m->snaps[i].ver != snap)
+            continue;
+        if(--m->snaps[i].refs == 0) {
+            memmove(&m->snaps[i], &m->snaps[i + 1], (m->nsnaps - i - 1) * sizeof(*m->snaps));
+            m->nsnaps--;
+            table_mvcc_gc(m);
+        }
+        return;
+    }
+}
+
+/* Drop the versions of one chain that no reader can reach: the head
+ * serves the current version and later snapshots, and an older version
+ * survives only while an open snapshot falls between its number and that
+ * of the next newer one. Returns 1 if the whole chain went.
+ */
+static int trim_chain(struct mvcc *m, struct chain *c)
+{
+    struct version *keep = c->head, *v = keep->older, *older;
+    unsigned long newer = keep->ver;
+    size_t j = m->nsnaps;
+
+    for(; v; v = older) {
+        older = v->older;
+        while(j && m->snaps[j - 1].ver >= newer)
+            j--;
+        newer = v->ver;
+        if(j && m->snaps[j - 1].ver >= v->ver) {
+            keep->older = v;
+            keep = v;
+        } else {
+            free(v);
+            m->versions--;
+        }
+    }
+    keep->older = NULL;
+
+    if(!c->head->older && c->head->dead && !table_remove(m->t, c->key, c->keylen)) {
+        free_chain(m, c->key, c->keylen, c);
+        return 1;
+    }
+    return 0;
+}
+
+size_t table_mvcc_gc(mvcc_t mv)
+{
+    struct mvcc *m = mv;
+    unsigned long before = m->versions;
+    struct chain *c = m->dirty, *next;
+
+    m->dirty = NULL;
+    for(; c; c = next) {
+        next = c->next_dirty;
+        c->dirty = 0;
+        if(trim_chain(m, c))
+            continue;
+        if(c->head->older || c->head->dead)
+            mark_dirty(m, c);
+    }
+    return before - m->versions;
+}
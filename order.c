@@ -0,0 +1,301 @@
+/* Ordered iteration.
+ *
+ * Entries are gathered into an array of records (robin hood straight
+ * from the slot array with the stored hashes, other engines through
+ * table_iter) and sorted there, so the callback sees a stable order that
+ * does not depend on the table's size or history.
+ *
+ * Hash order is an LSD radix sort, 16 bits per pass; equal hashes are
+ * then put in key order so the result is fully deterministic. Key order
+ * is a merge sort on a cached big-endian 8 byte key prefix, falling back
+ * to memcmp on ties. With nthreads > 1 the record array is cut into
+ * runs that are sorted on their own threads and merged pairwise, the
+ * merges of each round running in parallel too.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "table_internal.h"
+
+#define RADIX_BITS 16
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+struct rec {
+    unsigned long hash;
+    uint64_t prefix;            /* first 8 key bytes, big-endian, zero padded */
+    void *key;
+    size_t keylen;
+    void *data;
+};
+
+struct gather {
+    struct table_base *tb;
+    struct rec *r;
+    size_t n;
+};
+
+struct job {
+    struct rec *src, *dst;
+    size_t lo, mid, hi;
+};
+
+static uint64_t key_prefix(const void *key, size_t keylen)
+{
+    const unsigned char *k = key;
+    uint64_t p = 0;
+    size_t i = 0;
+
+    for(; i < 8; i++)
+        p = p << 8 | (i < keylen ? k[i] : 0);
+    return p;
+}
+
+static void set_rec(struct rec *r, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    r->hash = hash;
+    r->prefix = key_prefix(key, keylen);
+    r->key = key;
+    r->keylen = keylen;
+    r->data = data;
+}
+
+/* Bytewise key order, shorter first on a common prefix */
+static int key_cmp(const struct rec *a, const struct rec *b)
+{
+    size_t n;
+    int c;
+
+    if(a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    n = a->keylen < b->keylen ? a->keylen : b->keylen;
+    if(n > 8 && (c = memcmp((char *)a->key + 8, (char *)b->key + 8, n - 8)))
+        return c;
+    return (a->keylen > b->keylen) - (a->keylen < b->keylen);
+}
+
+static int gather_visit(void *arg, void *key, size_t keylen, void *data)
+{
+    struct gather *g = arg;
+    set_rec(&g->r[g->n++], g->tb->hash(key, keylen), key, keylen, data);
+    return 0;
+}
+
+/* Records for every entry; *n gets the count */
+static struct rec *gather(struct table_base *tb, size_t *n)
+{
+    struct table_stats st;
+    struct gather g = { tb, NULL, 0 };
+    struct table *ta = (struct table *)tb;
+    size_t pos;
+
+    if(table_get_stats(tb, &st) || !(g.r = malloc((st.elements ? st.elements : 1) * sizeof(*g.r))))
+        return NULL;
+
+    if(tb->engine == TABLE_ENGINE_ROBIN_HOOD) {
+        for(pos = rh_next_alive(ta, 0); pos < ta->size; pos = rh_next_alive(ta, pos + 1)) {
+            struct entry *e = &ta->table[pos];
+            set_rec(&g.r[g.n++], e->hash, e->key, e->keylen, e->data);
+        }
+    } else {
+        table_iter(tb, gather_visit, &g);
+    }
+    *n = g.n;
+    return g.r;
+}
+
+static void merge(struct rec *src, struct rec *dst, size_t lo, size_t mid, size_t hi)
+{
+    size_t i = lo, j = mid, k = lo;
+
+    while(i < mid && j < hi)
+        dst[k++] = key_cmp(&src[j], &src[i]) < 0 ? src[j++] : src[i++];
+    memcpy(&dst[k], &src[i], (mid - i) * sizeof(*dst));
+    k += mid - i;
+    memcpy(&dst[k], &src[j], (hi - j) * sizeof(*dst));
+}
+
+/* Bottom-up merge sort of r[lo, hi) using tmp; the result ends in r */
+static void merge_sort(struct rec *r, struct rec *tmp, size_t lo, size_t hi)
+{
+    struct rec *src = r, *dst = tmp, *t;
+    size_t width, i, j;
+
+    /* insertion sort runs of 16 first */
+    for(i = lo; i < hi; i += 16) {
+        size_t end = i + 16 < hi ? i + 16 : hi;
+        for(j = i + 1; j < end; j++) {
+            struct rec x = r[j];
+            size_t k = j;
+            for(; k > i && key_cmp(&x, &r[k - 1]) < 0; k--)
+                r[k] = r[k - 1];
+            r[k] = x;
+        }
+    }
+
+    for(width = 16; width < hi - lo; width *= 2) {
+        for(i = lo; i < hi; i += 2 * width) {
+            size_t mid = i + width < hi ? i + width : hi;
+            size_t end = i + 2 * width < hi ? i + 2 * width : hi;
+            merge(src, dst, i, mid, end);
+        }
+        t = src;
+        src = dst;
+        dst = t;
+    }
+    if(src != r)
+        memcpy(&r[lo], &src[lo], (hi - lo) * sizeof(*r));
+}
+
+static void *sort_job(void *arg)
+{
+    struct job *j = arg;
+    merge_sort(j->src, j->dst, j->lo, j->hi);
+    return NULL;
+}
+
+static void *merge_job(void *arg)
+{
+    struct job *j = arg;
+    merge(j->src, j->dst, j->lo, j->mid, j->hi);
+    return NULL;
+}
+
+/* Run fn over jobs, all but the first on their own threads. A job
+ * whose thread fails to start runs on the caller.
+ */
+static void run_jobs(void *(*fn)(void *), struct job *jobs, pthread_t *tid, size_t n)
+{
+    size_t i, started = 0;
+
+    for(i = 1; i < n; i++, started++) {
+        if(pthread_create(&tid[i], NULL, fn, &jobs[i]))
+            break;
+    }
+    fn(&jobs[0]);
+    for(i = 1; i <= started; i++)
+        pthread_join(tid[i], NULL);
+    for(i = started + 1; i < n; i++)
+        fn(&jobs[i]);
+}
+
+static int sort_by_key(struct rec *r, size_t n, unsigned int nthreads)
+{
+    struct rec *tmp = malloc((n ? n : 1) * sizeof(*tmp)), *src = r, *dst = tmp, *t;
+    size_t *bound, runs, i, m;
+    struct job *jobs;
+    pthread_t *tid;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > n / 4096 + 1)
+        nthreads = n / 4096 + 1;
+
+    bound = malloc((nthreads + 1) * sizeof(*bound));
+    jobs = calloc(nthreads, sizeof(*jobs));
+    tid = calloc(nthreads, sizeof(*tid));
+    if(!tmp || !bound || !jobs || !tid) {
+        free(tmp);
+        free(bound);
+        free(jobs);
+        free(tid);
+        return -1;
+    }
+
+    for(i = 0; i <= nthreads; i++)
+        bound[i] = n * i / nthreads;
+    for(i = 0; i < nthreads; i++) {
+        jobs[i].src = r;
+        jobs[i].dst = tmp;
+        jobs[i].lo = bound[i];
+        jobs[i].hi = bound[i + 1];
+    }
+    run_jobs(sort_job, jobs, tid, nthreads);
+
+    /* merge neighbouring runs until one is left */
+    for(runs = nthreads; runs > 1; runs = (runs + 1) / 2) {
+        for(i = 0, m = 0; i < runs; i += 2, m++) {
+            jobs[m].src = src;
+            jobs[m].dst = dst;
+            jobs[m].lo = bound[i];
+            jobs[m].mid = i + 1 < runs ? bound[i + 1] : bound[runs];
+            jobs[m].hi = i + 2 < runs ? bound[i + 2] : bound[runs];
+            bound[m] = bound[i];
+        }
+        bound[m] = n;
+        run_jobs(merge_job, jobs, tid, m);
+        t = src;
+        src = dst;
+        dst = t;
+    }
+    if(src != r)
+        memcpy(r, src, n * sizeof(*r));
+
+    free(tmp);
+    free(bound);
+    free(jobs);
+    free(tid);
+    return 0;
+}
+
+static int sort_by_hash(struct rec *r, size_t n)
+{
+    struct rec *tmp = malloc((n ? n : 1) * sizeof(*tmp)), *src = r, *dst = tmp, *t;
+    size_t *count = malloc(RADIX_SIZE * sizeof(*count)), i, sum, c;
+    unsigned int shift = 0, d;
+
+    if(!tmp || !count) {
+        free(tmp);
+        free(count);
+        return -1;
+    }
+
+    for(; shift < sizeof(unsigned long) * 8; shift += RADIX_BITS) {
+        memset(count, 0, RADIX_SIZE * sizeof(*count));
+        for(i = 0; i < n; i++)
+            count[(src[i].hash >> shift) & (RADIX_SIZE - 1)]++;
+        /* a digit every hash shares moves nothing */
+        if(n && count[(src[0].hash >> shift) & (RADIX_SIZE - 1)] == n)
+            continue;
+        for(d = 0, sum = 0; d < RADIX_SIZE; d++) {
+            c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for(i = 0; i < n; i++)
+            dst[count[(src[i].hash >> shift) & (RADIX_SIZE - 1)]++] = src[i];
+        t = src;
+        src = dst;
+        dst = t;
+    }
+    if(src != r)
+        memcpy(r, src, n * sizeof(*r));
+
+    /* order equal hashes by key */
+    for(i = 0; i < n; i = c) {
+        for(c = i + 1; c < n && r[c].hash == r[i].hash; c++)
+            ;
+        if(c - i > 1)
+            merge_sort(r, tmp, i, c);
+    }
+
+    free(tmp);
+    free(count);
+    return 0;
+}
+
+int table_iter_sorted(table_t t, enum table_order order, iter_func f, void *arg, unsigned int nthreads)
+{
+    struct rec *r;
+    size_t n, i;
+    int ret;
+
+    if(!(r = gather(t, &n)))
+        return -1;
+    ret = order == TABLE_ORDER_KEY ? sort_by_key(r, n, nthreads) : sort_by_hash(r, n);
+    for(i = 0; !ret && i < n; i++)
+        ret = f(arg, r[i].key, r[i].keylen, r[i].data);
+    free(r);
+    return ret;
+}
@@ -0,0 +1,192 @@
+/* Hot-key and long-probe sampling.
+ *
+ * The dispatch layer hands every successful get and insert to
+ * sampler_note while a sampler is attached; only one in 2^shift of them
+ * (picked by a xorshift generator, so periodic access patterns don't
+ * alias with the sampling) does any work. A sampled key bumps its
+ * count-min row counters and is offered to two small top-k lists, one
+ * ranked by estimated count and one by probe length. k is small, so the
+ * lists are plain arrays searched linearly.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "table_internal.h"
+
+#define CMS_DEPTH 4
+#define CMS_WIDTH 2048          /* power of two */
+#define SAMPLER_MAX_K 1024
+
+struct slot {
+    void *key;                  /* owned copy, NULL when free */
+    size_t keylen;
+    unsigned long hash;
+    unsigned long count;
+};
+
+struct table_sampler {
+    unsigned int k;
+    unsigned int shift;
+    unsigned long rng;
+    unsigned int cms[CMS_DEPTH][CMS_WIDTH];
+    struct slot *hot;
+    struct slot *longp;
+};
+
+static const unsigned long cms_seed[CMS_DEPTH] = {
+    0x9e3779b97f4a7c15UL, 0xc2b2ae3d27d4eb4fUL, 0x165667b19e3779f9UL, 0xd6e8feb86659fd93UL,
+};
+
+static size_t cms_index(unsigned long hash, int row)
+{
+    unsigned long h = (hash ^ cms_seed[row]) * 0xff51afd7ed558ccdUL;
+    return (h >> 40) & (CMS_WIDTH - 1);
+}
+
+/* Count one access and return the new estimate */
+static unsigned long cms_add(struct table_sampler *s, unsigned long hash)
+{
+    unsigned int est = ~0U, *c;
+    int row = 0;
+
+    for(; row < CMS_DEPTH; row++) {
+        c = &s->cms[row][cms_index(hash, row)];
+        if(*c != ~0U)
+            (*c)++;
+        if(*c < est)
+            est = *c;
+    }
+    return est;
+}
+
+/* Offer key with weight count to a top-k list. A key already listed
+ * takes the new count; otherwise it replaces the smallest entry if it
+ * beats it, or fills a free one.
+ */
+static void offer(struct slot *list, unsigned int k, unsigned long hash, void *key,
+                  size_t keylen, unsigned long count)
+{
+    struct slot *min = NULL, *sl;
+    unsigned int i = 0;
+    void *copy;
+
+    for(; i < k; i++) {
+        sl = &list[i];
+        if(sl->key && sl->hash == hash && sl->keylen == keylen && !memcmp(sl->key, key, keylen)) {
+            sl->count = count;
+            return;
+        }
+        if(!min || !sl->key || (min->key && sl->count < min->count))
+            min = sl;
+    }
+    if(min->key && count <= min->count)
+        return;
+    if(!(copy = malloc(keylen ? keylen : 1)))
+        return;
+    memcpy(copy, key, keylen);
+    free(min->key);
+    min->key = copy;
+    min->keylen = keylen;
+    min->hash = hash;
+    min->count = count;
+}
+
+void sampler_note(struct table_base *tb, void *key, size_t keylen)
+{
+    struct table_sampler *s = tb->sampler;
+    unsigned long hash;
+    int probes;
+
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    if(s->rng & ((1UL << s->shift) - 1))
+        return;
+
+    hash = tb->hash(key, keylen);
+    offer(s->hot, s->k, hash, key, keylen, cms_add(s, hash) << s->shift);
+    if((probes = tb->ops->key_probes(tb, key, keylen)) > 0)
+        offer(s->longp, s->k, hash, key, keylen, probes);
+}
+
+static int by_count(const void *a, const void *b)
+{
+    const struct slot *x = a, *y = b;
+    if(!x->key || !y->key)
+        return !x->key - !y->key;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static size_t report(struct table_sampler *s, struct slot *list, struct table_sample *out, size_t n)
+{
+    size_t i = 0;
+
+    if(!s)
+        return 0;
+    qsort(list, s->k, sizeof(*list), by_count);
+    for(; i < n && i < s->k && list[i].key; i++) {
+        out[i].key = list[i].key;
+        out[i].keylen = list[i].keylen;
+        out[i].count = list[i].count;
+    }
+    return i;
+}
+
+/* Attach a sampler, replacing any previous one. k is capped at
+ * SAMPLER_MAX_K and rate_shift at 31
+ */
+int table_sampler_enable(table_t t, unsigned int k, unsigned int rate_shift)
+{
+    struct table_base *tb = t;
+    struct table_sampler *s;
+
+    if(k == 0 || k > SAMPLER_MAX_K || rate_shift > 31)
+        return -1;
+    if(!(s = calloc(1, sizeof(*s))))
+        return -1;
+    s->hot = calloc(k, sizeof(*s->hot));
+    s->longp = calloc(k, sizeof(*s->longp));
+    if(!s->hot || !s->longp) {
+        free(s->hot);
+        free(s->longp);
+        free(s);
+        return -1;
+    }
+    s->k = k;
+    s->shift = rate_shift;
+    s->rng = 0x2545f4914f6cdd1dUL ^ (unsigned long)(size_t)t;
+
+    table_sampler_disable(t);
+    tb->sampler = s;
+    return 0;
+}
+
+void table_sampler_disable(table_t t)
+{
+    struct table_base *tb = t;
+    struct table_sampler *s = tb->sampler;
+    unsigned int i = 0;
+
+    if(!s)
+        return;
+    for(; i < s->k; i++) {
+        free(s->hot[i].key);
+        free(s->longp[i].key);
+    }
+    free(s->hot);
+    free(s->longp);
+    free(s);
+    tb->sampler = NULL;
+}
+
+size_t table_sampler_hot(table_t t, struct table_sample *out, size_t n)
+{
+    struct table_base *tb = t;
+    return report(tb->sampler, tb->sampler ? tb->sampler->hot : NULL, out, n);
+}
+
+size_t table_sampler_long_probes(table_t t, struct table_sample *out, size_t n)
+{
+    struct table_base *tb = t;
+    return report(tb->sampler, tb->sampler ? tb->sampler->longp : NULL, out, n);
+}
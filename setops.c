@@ -0,0 +1,251 @@
+/* Bulk set algebra over tables.
+ *
+ * Every operation reduces to scanning one side and probing the other:
+ *   intersect:  scan the smaller side, keep keys found in the other
+ *   difference: scan a, keep keys not found in b
+ *   union:      copy a, then add the difference b - a
+ * Values always come from a, except for the keys union takes from b.
+ *
+ * Difference scans a even when b is much smaller: every key of a - b has
+ * to be visited to be copied out anyway, and a small b stays in cache
+ * while it is probed. Scanning b instead would mean copying all of a and
+ * removing b's keys, leaving tombstones in out. Union reserves room for
+ * both sides up front; a caller that already sized out larger keeps its
+ * size, since a reserve never shrinks.
+ *
+ * When both sides are robin hood tables sharing a hash function the scan
+ * walks the slot array directly and probes with the stored hash, in
+ * batches whose first probe slots are prefetched ahead of the compares.
+ * That path can also be split over threads, each collecting its matches
+ * for the caller's thread to insert. Union's copy of a robin hood a takes
+ * the same path with nothing to probe, so every live entry is collected
+ * and inserted under its stored hash. Other combinations go through
+ * table_iter/table_get.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "table_internal.h"
+
+#define SETOP_BATCH 16
+
+struct match {
+    struct entry *e;
+    void *data;
+};
+
+struct scan {
+    struct table *s;        /* scanned side */
+    struct table *p;        /* probed side, NULL to keep every entry */
+    int want;               /* keep when (found in p) == want */
+    int data_from_probe;    /* take the value from p's entry instead of s's */
+    size_t lo, hi;          /* slot range of s */
+    struct match *m;        /* collected matches */
+    size_t n, cap;
+};
+
+struct generic {
+    table_t p;
+    table_t out;
+    int want;
+    int data_from_probe;
+    int err;
+};
+
+static size_t count(table_t t)
+{
+    struct table_stats st;
+    return table_get_stats(t, &st) ? 0 : st.elements;
+}
+
+static int is_rh(table_t t)
+{
+    return ((struct table_base *)t)->engine == TABLE_ENGINE_ROBIN_HOOD;
+}
+
+/* Insert into out, reusing the stored hash when out hashes the same way */
+static int emit(table_t out, hash_func h, struct entry *e, void *data)
+{
+    if(((struct table_base *)out)->hash == h)
+        return table_insert_hashed(out, e->hash, e->key, e->keylen, data);
+    return table_insert(out, e->key, e->keylen, data);
+}
+
+static int add_match(struct scan *sc, struct entry *e, void *data)
+{
+    if(sc->n == sc->cap) {
+        size_t cap = sc->cap ? sc->cap * 2 : 256;
+        struct match *m = realloc(sc->m, cap * sizeof(*m));
+        if(!m)
+            return -1;
+        sc->m = m;
+        sc->cap = cap;
+    }
+    sc->m[sc->n].e = e;
+    sc->m[sc->n].data = data;
+    sc->n++;
+    return 0;
+}
+
+/* Probe slots [lo, hi) of s against p a batch at a time: gather up to
+ * SETOP_BATCH live entries, prefetch where each one's search starts,
+ * then run the searches. Matches are appended to sc->m.
+ */
+static int scan_range(struct scan *sc)
+{
+    struct entry *batch[SETOP_BATCH];
+    size_t pos = sc->lo, n, i;
+
+    while(pos < sc->hi) {
+        for(n = 0; n < SETOP_BATCH && (pos = rh_next_alive(sc->s, pos)) < sc->hi; pos++) {
+            batch[n] = &sc->s->table[pos];
+            if(sc->p)
+                rh_prefetch_hash(sc->p, batch[n]->hash);
+            n++;
+        }
+        for(i = 0; i < n; i++) {
+            struct entry *e = batch[i];
+            ssize_t hit = sc->p ? rh_search_hash(sc->p, e->hash, e->key, e->keylen) : 0;
+            if((hit >= 0) == sc->want) {
+                void *data = (hit >= 0 && sc->data_from_probe) ? sc->p->table[hit].data : e->data;
+                if(add_match(sc, e, data))
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void *scan_thread(void *arg)
+{
+    struct scan *sc = arg;
+    return scan_range(sc) ? sc : NULL;
+}
+
+static int rh_setop(table_t out, struct table *s, struct table *p, int want,
+                    int data_from_probe, unsigned int nthreads)
+{
+    struct scan *sc;
+    pthread_t *tid;
+    unsigned int i, started = 0;
+    size_t j;
+    int prefetch, ret = 0;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > s->size / 1024 + 1)
+        nthreads = s->size / 1024 + 1;
+
+    sc = calloc(nthreads, sizeof(*sc));
+    tid = calloc(nthreads, sizeof(*tid));
+    if(!sc || !tid) {
+        free(sc);
+        free(tid);
+        return -1;
+    }
+
+    for(i = 0; i < nthreads; i++) {
+        sc[i].s = s;
+        sc[i].p = p;
+        sc[i].want = want;
+        sc[i].data_from_probe = data_from_probe;
+        sc[i].lo = s->size * i / nthreads;
+        sc[i].hi = s->size * (i + 1) / nthreads;
+    }
+
+    /* Thread 0's share runs on the caller */
+    for(i = 1; i < nthreads; i++, started++) {
+        if(pthread_create(&tid[i], NULL, scan_thread, &sc[i]))
+            break;
+    }
+    if(scan_range(&sc[0]))
+        ret = -1;
+    for(i = 1; i <= started; i++) {
+        void *failed;
+        pthread_join(tid[i], &failed);
+        if(failed)
+            ret = -1;
+    }
+    /* Any range whose thread never started is done here */
+    for(i = started + 1; i < nthreads; i++) {
+        if(scan_range(&sc[i]))
+            ret = -1;
+    }
+
+    /* A robin hood out under the same hash has its first probe slots
+     * prefetched a batch ahead of the inserts
+     */
+    prefetch = is_rh(out) && ((struct table *)out)->hash == s->hash;
+    for(i = 0; i < nthreads; i++) {
+        for(j = 0; !ret && j < sc[i].n; j++) {
+            if(prefetch && j + SETOP_BATCH < sc[i].n)
+                rh_prefetch_insert(out, sc[i].m[j + SETOP_BATCH].e->hash);
+            if(emit(out, s->hash, sc[i].m[j].e, sc[i].m[j].data))
+                ret = -1;
+        }
+        free(sc[i].m);
+    }
+
+    free(sc);
+    free(tid);
+    return ret;
+}
+
+static int generic_visit(void *arg, void *key, size_t keylen, void *data)
+{
+    struct generic *g = arg;
+    void *pdata;
+    int found = !table_get(g->p, key, keylen, &pdata);
+
+    if(found != g->want)
+        return 0;
+    if(table_insert(g->out, key, keylen, (found && g->data_from_probe) ? pdata : data)) {
+        g->err = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int setop(table_t out, table_t s, table_t p, int want, int data_from_probe, unsigned int nthreads)
+{
+    struct generic g = { p, out, want, data_from_probe, 0 };
+
+    if(is_rh(s) && is_rh(p) && ((struct table *)s)->hash == ((struct table *)p)->hash)
+        return rh_setop(out, s, p, want, data_from_probe, nthreads);
+
+    table_iter(s, generic_visit, &g);
+    return g.err ? -1 : 0;
+}
+
+static int copy_visit(void *arg, void *key, size_t keylen, void *data)
+{
+    return table_insert(arg, key, keylen, data) ? 1 : 0;
+}
+
+int table_intersect(table_t out, table_t a, table_t b, unsigned int nthreads)
+{
+    if(out == a || out == b)
+        return -1;
+    if(count(b) < count(a))
+        return setop(out, b, a, 1, 1, nthreads);
+    return setop(out, a, b, 1, 0, nthreads);
+}
+
+int table_difference(table_t out, table_t a, table_t b, unsigned int nthreads)
+{
+    if(out == a || out == b)
+        return -1;
+    return setop(out, a, b, 0, 0, nthreads);
+}
+
+int table_union(table_t out, table_t a, table_t b, unsigned int nthreads)
+{
+    if(out == a || out == b)
+        return -1;
+    if(table_reserve(out, count(a) + count(b)))
+        return -1;
+    if(is_rh(a) ? rh_setop(out, a, NULL, 1, 0, nthreads) : table_iter(a, copy_visit, out))
+        return -1;
+    return setop(out, b, a, 0, 0, nthreads);
+}
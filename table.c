@@ -5,11 +5,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
-#include "table.h"
+#include "table_internal.h"
 
 #define TABLE_SIZE_DEFAULT 547
 #define TABLE_MAX_LOAD_FACTOR 0.95
+#define TABLE_GROWTH 2.5
+#define RH_BATCH 64         /* keys hashed ahead of placement */
+#define RH_PREFETCH 8       /* placement distance of the first slot prefetch */
+#define RH_ERASE_REBUILD 4  /* erase_if rebuilds in place once 1/N of the slots are tombstones */
 
 #define MAX(a,b) \
     ({ __typeof__ (a) _a = (a); \
@@ -21,39 +26,19 @@
        __typeof__ (b) _b = (b); \
        _a < _b ? _a : _b; })
 
-typedef int(*cmp_func)(void*, void*, size_t);
-typedef unsigned long(*hash_func)(void*, size_t);
-
-struct entry {
-    unsigned long hash;
-    void *key;
-    void *data;
-    size_t keylen;
-    unsigned int probepos;
-    unsigned int alive;
-};
-
-struct table {
-    struct entry *table;
-    size_t size;
-    size_t step_prime;
-    unsigned int totalweight;
-    unsigned int maxprobe;
-    unsigned int elements;
-    hash_func hash;
-    cmp_func cmp;
-};
-
 static int is_prime(size_t n);
 static size_t next_prime_size(size_t cur_size, float scalar);
 static size_t next_prime_step(size_t cur_size);
-static unsigned long table_hash(void *k, size_t len);
-static int table_cmp(void *k1, void *k2, size_t len);
 static ssize_t internal_search(table_t t, void *key, size_t keylen);
+static ssize_t search_probes(struct table *ta, unsigned long hash, cmp_func cmp, void *key, size_t keylen, unsigned int *probes);
+static int resize_table(table_t t, size_t new_size);
 static int grow_table(table_t t);
+static int rh_insert(table_t t, void *key, size_t keylen, void *data);
+
+static const struct table_ops rh_ops;
 
 /* Wrapper to cast the keys for compare */
-static int table_cmp(void *k1, void *k2, size_t len)
+int table_cmp(void *k1, void *k2, size_t len)
 {
     return strncmp((const char *)k1, (const char *)k2, len);
 }
@@ -61,7 +46,7 @@ static int table_cmp(void *k1, void *k2, size_t len)
 /* Type checking needs to be done before
  * Simple djb2 hash 
  */
-static unsigned long table_hash(void *k, size_t len)
+unsigned long table_hash(void *k, size_t len)
 {
     char *key = k;
     unsigned long hash = 5381;
@@ -71,6 +56,26 @@ static unsigned long table_hash(void *k, size_t len)
     return hash;
 }
 
+void table_hasher_init(struct table_hasher *hs)
+{
+    hs->h = 5381;
+}
+
+void table_hasher_update(struct table_hasher *hs, const void *buf, size_t len)
+{
+    const char *key = buf;
+    unsigned long hash = hs->h;
+    size_t c = 0;
+    for(; c < len; c++)
+        hash = ((hash << 5) + hash) + key[c];
+    hs->h = hash;
+}
+
+unsigned long table_hasher_final(const struct table_hasher *hs)
+{
+    return hs->h;
+}
+
 /* Very simple primality test. 
  * We scale the size by some scalar and then
  * walk up until we find the next prime to use
@@ -113,20 +118,36 @@ static size_t next_prime_step(size_t cur_size)
     return new_step;
 }
 
-/* Grow the table by 2.5 times to the next closest
- * prime above cur_size * 2.5
+/* Grow the table by the growth factor (2.5 by default)
+ * to the next closest prime above cur_size * growth
  */
 static int grow_table(table_t t)
 {
-    float scalar = 2.5;
+    struct table *ta = t;
+    size_t n = next_prime_size(ta->size, ta->growth);
+    /* a growth close to 1 may not get past the current prime */
+    return resize_table(t, n > ta->size ? n : next_prime_size(ta->size + 1, 1));
+}
+
+/* Rebuild the table at new_size (a prime), re-placing every live entry
+ * with its stored hash
+ */
+static int resize_table(table_t t, size_t new_size)
+{
     struct table *ta = t;
     struct entry *old_table = ta->table;
-    size_t new_size = next_prime_size(ta->size, scalar), old_size = ta->size;
-    int i = 0;
+    uint64_t *old_map = ta->alivemap;
+    size_t old_size = ta->size;
+    unsigned long long start = table_now_ns();
+    size_t i;
 
     ta->table = calloc(new_size, sizeof(*ta->table));
-    if(!ta->table) {
+    ta->alivemap = calloc(ALIVE_WORDS(new_size), sizeof(*ta->alivemap));
+    if(!ta->table || !ta->alivemap) {
+        free(ta->table);
+        free(ta->alivemap);
         ta->table = old_table;
+        ta->alivemap = old_map;
         return -1;
     }
 
@@ -135,20 +156,28 @@ static int grow_table(table_t t)
     // If I'm re-using insert I need to reset element count
     // and maxprobe/weight etc.
     ta->elements = 0;
+    ta->dead = 0;
     ta->maxprobe = 0;
     ta->totalweight = 0;
+    ta->grows++;
 
-    for(; i < old_size; i++) {
-        if(old_table[i].alive) {
-            table_insert(t, old_table[i].key, old_table[i].keylen, old_table[i].data);
+    /* rh_next_alive reads ta's map, so walk the old one by hand */
+    for(i = 0; i < ALIVE_WORDS(old_size); i++) {
+        uint64_t bits = old_map[i];
+        while(bits) {
+            struct entry *e = &old_table[(i << 6) + __builtin_ctzll(bits)];
+            rh_insert_hash(ta, e->hash, e->key, e->keylen, e->data);
+            bits &= bits - 1;
         }
     }
 
     free(old_table);
+    free(old_map);
+    ta->base.grow_ns += table_now_ns() - start;
     return 0;
 }
 
-void table_print_stats(table_t t)
+static void rh_print_stats(table_t t)
 {
     struct table *ta = t;
     printf("Table Diagnostics\n");
@@ -156,11 +185,25 @@ void table_print_stats(table_t t)
     printf("Table Size: %lu, Elements %d, Load Factor: %f\n", ta->size, ta->elements, (float)ta->elements/(float)ta->size);
     printf("Table Weight: %d, Average Probe: %d, Max Probe: %d\n", ta->totalweight, ta->totalweight/ta->elements, ta->maxprobe);
 }
-/* table_new generates a new table at the default size
- * it takes optionally a hashing function and a compare
- * function. By default it uses string keys and double hashing
+
+/* Fill in a snapshot of the table counters */
+static int rh_get_stats(table_t t, struct table_stats *st)
+{
+    struct table *ta = t;
+    st->size = ta->size;
+    st->elements = ta->elements;
+    st->memory = sizeof(*ta) + ta->size * sizeof(*ta->table) + ALIVE_WORDS(ta->size) * sizeof(*ta->alivemap);
+    st->totalweight = ta->totalweight;
+    st->maxprobe = ta->maxprobe;
+    st->grows = ta->grows;
+    st->recycle_searches = ta->recycle_searches;
+    return 0;
+}
+
+/* rh_new generates a new robin hood table at the default size.
+ * hash/cmp are already resolved by table_new_ex
  */
-table_t table_new(hash_func h, cmp_func c)
+static table_t rh_new(const struct table_config *cfg)
 {
     struct table *t = malloc(sizeof(*t));
     if(!t) {
@@ -168,7 +211,10 @@ table_t table_new(hash_func h, cmp_func c)
     }
 
     t->table = calloc(TABLE_SIZE_DEFAULT, sizeof(*t->table));
-    if(!t->table) {
+    t->alivemap = calloc(ALIVE_WORDS(TABLE_SIZE_DEFAULT), sizeof(*t->alivemap));
+    if(!t->table || !t->alivemap) {
+        free(t->table);
+        free(t->alivemap);
         free(t);
         return NULL;
     }
@@ -176,38 +222,176 @@ table_t table_new(hash_func h, cmp_func c)
     t->size = TABLE_SIZE_DEFAULT;
     t->totalweight = 0;
     t->elements = 0;
+    t->dead = 0;
     t->maxprobe = 0;
-    t->hash = h?h:table_hash;
-    t->cmp = c?c:table_cmp;
+    t->grows = 0;
+    t->recycle_searches = 0;
+    memset(&t->base, 0, sizeof(t->base));
+    t->base.ops = &rh_ops;
+    t->base.engine = TABLE_ENGINE_ROBIN_HOOD;
+    t->hash = cfg->hash;
+    t->cmp = cfg->cmp;
     t->step_prime = next_prime_step(t->size);
+    t->linear = cfg->probe == TABLE_PROBE_LINEAR;
+    t->max_load = cfg->max_load ? cfg->max_load : TABLE_MAX_LOAD_FACTOR;
+    t->growth = cfg->growth ? cfg->growth : TABLE_GROWTH;
 
     return t;
 }
 
-/* table_insert adds a new element to the table if it doesn't already exist.
- * returns 0 on success, non-zero error
+/* Release the table. Keys and data are owned by the caller */
+static void rh_free(table_t t)
+{
+    struct table *ta = t;
+    free(ta->table);
+    free(ta->alivemap);
+    free(ta);
+}
+
+/* Same-size copy: one allocation and memcpy for the slot array */
+static table_t rh_clone(table_t t)
+{
+    struct table *ta = t, *c = malloc(sizeof(*c));
+    if(!c)
+        return NULL;
+
+    memcpy(c, ta, sizeof(*c));
+    c->table = malloc(ta->size * sizeof(*c->table));
+    c->alivemap = malloc(ALIVE_WORDS(ta->size) * sizeof(*c->alivemap));
+    if(!c->table || !c->alivemap) {
+        free(c->table);
+        free(c->alivemap);
+        free(c);
+        return NULL;
+    }
+    memcpy(c->table, ta->table, ta->size * sizeof(*c->table));
+    memcpy(c->alivemap, ta->alivemap, ALIVE_WORDS(ta->size) * sizeof(*c->alivemap));
+    return c;
+}
+
+static int rh_find(table_t t, unsigned long hash, cmp_func cmp, void *key, size_t keylen, void **data_ptr)
+{
+    struct table *ta = t;
+    ssize_t pos = search_probes(ta, hash, cmp, key, keylen, NULL);
+
+    *data_ptr = pos >= 0 ? ta->table[pos].data : NULL;
+    return pos >= 0 ? 0 : -1;
+}
+
+static int rh_key_probes(table_t t, void *key, size_t keylen)
+{
+    struct table *ta = t;
+    ssize_t pos = rh_search_hash(ta, ta->hash(key, keylen), key, keylen);
+
+    return pos < 0 ? -1 : (int)ta->table[pos].probepos;
+}
+
+static void rh_probe_counts(table_t t, unsigned long *counts, size_t n)
+{
+    struct table *ta = t;
+    size_t pos = rh_next_alive(ta, 0);
+
+    for(; pos < ta->size; pos = rh_next_alive(ta, pos + 1))
+        counts[MIN((size_t)ta->table[pos].probepos, n - 1)]++;
+}
+
+static size_t rh_dump_slots(table_t t, struct table_slot *slots, size_t n)
+{
+    struct table *ta = t;
+    size_t pos = 0;
+
+    if(n < ta->size)
+        return ta->size;
+    for(; pos < ta->size; pos++) {
+        struct entry *e = &ta->table[pos];
+        slots[pos].hash = e->key ? e->hash : 0;
+        slots[pos].probe = e->key ? e->probepos : 0;
+        slots[pos].state = e->alive ? TABLE_SLOT_ALIVE : e->key ? TABLE_SLOT_DEAD : TABLE_SLOT_EMPTY;
+    }
+    return ta->size;
+}
+
+/* Make room for n more entries without growing on the way. A resize
+ * is at least a normal grow, so reserving batch after batch stays
+ * amortised rather than rebuilding for every few extra entries
  */
-int table_insert(table_t t, void *key, size_t keylen, void *data)
+static int rh_reserve(table_t t, size_t n)
+{
+    struct table *ta = t;
+    size_t need = (size_t)((ta->elements + n) / ta->max_load) + 1;
+
+    if(need <= ta->size)
+        return 0;
+    need = MAX(need, (size_t)(ta->size * ta->growth));
+    return resize_table(t, next_prime_size(need, 1));
+}
+
+static int rh_insert(table_t t, void *key, size_t keylen, void *data)
+{
+    struct table *ta = t;
+    return rh_insert_hash(ta, ta->hash(key, keylen), key, keylen, data);
+}
+
+/* Hash a run of keys first, then place them with each key's first slot
+ * prefetched RH_PREFETCH items ahead of its placement. Each run reserves
+ * room for itself before hashing, so the prefetched slots stay put and a
+ * batch of updates never sizes the table for keys it doesn't add
+ */
+static int rh_insert_batch(table_t t, void **keys, const size_t *keylens, void **datas, size_t n, int *results)
 {
     struct table *ta = t;
+    unsigned long hash[RH_BATCH];
+    size_t i, j, m, failed = 0;
+    int ret;
+
+    for(i = 0; i < n; i += m) {
+        m = MIN(n - i, RH_BATCH);
+        rh_reserve(t, m);
+        for(j = 0; j < m; j++) {
+            hash[j] = ta->hash(keys[i + j], keylens[i + j]);
+            if(j < RH_PREFETCH)
+                __builtin_prefetch(&ta->table[(hash[j] + rh_step(ta, hash[j])) % ta->size], 1);
+        }
+        for(j = 0; j < m; j++) {
+            if(j + RH_PREFETCH < m) {
+                unsigned long h = hash[j + RH_PREFETCH];
+                __builtin_prefetch(&ta->table[(h + rh_step(ta, h)) % ta->size], 1);
+            }
+            ret = rh_insert_hash(ta, hash[j], keys[i + j], keylens[i + j], datas[i + j]);
+            if(results)
+                results[i + j] = ret;
+            failed += ret != 0;
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+/* rh_insert_hash adds a new element to the table if it doesn't already exist.
+ * hash must be ta->hash(key, keylen).
+ * returns 0 on success, non-zero error
+ */
+int rh_insert_hash(struct table *ta, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    table_t t = ta;
     struct entry *e = NULL, r;
     unsigned long step;
 
-    r.hash = ta->hash(key, keylen);
+    r.hash = hash;
     r.key = key;
     r.data = data;
     r.probepos = 0;
     r.alive = 1;
     r.keylen = keylen;
 
-    step = ta->step_prime - (r.hash % ta->step_prime);
-
     if(ta->elements == ta->size)
         return -1;
 
-    if((float)ta->elements/(float)ta->size > TABLE_MAX_LOAD_FACTOR)
+    if((float)ta->elements/(float)ta->size > ta->max_load)
         grow_table(t);
 
+    /* after any grow: the stride depends on the table's step prime */
+    step = rh_step(ta, r.hash);
+
     for(;;) {
         r.probepos++;
         ta->totalweight++;
@@ -220,16 +404,30 @@ int table_insert(table_t t, void *key, size_t keylen, void *data)
                 // probe sequence (i.e. the recycled position opened up between
                 // the first insert and this one for this key). If we find the key
                 // we should clear it and decrement the table totalweight appropriately
-                ssize_t pos = internal_search(t, r.key, r.keylen);
+                ssize_t pos;
+                if(TRACE_ON(&ta->base)) {
+                    unsigned long long start = table_now_ns();
+                    unsigned int probes;
+                    pos = search_probes(ta, r.hash, ta->cmp, r.key, r.keylen, &probes);
+                    table_trace_check(&ta->base, TABLE_TRACE_RECYCLE, r.key, r.keylen, r.hash,
+                                      probes, table_now_ns() - start);
+                } else {
+                    pos = rh_search_hash(ta, r.hash, r.key, r.keylen);
+                }
+                ta->recycle_searches++;
                 if(pos != -1) {
                     memcpy(e, &r, sizeof(struct entry));
+                    rh_set_alive(ta, e - ta->table);
                     ta->table[pos].alive = 0;
+                    rh_clear_alive(ta, pos);
                     ta->totalweight -= ta->table[pos].probepos;
                     // Exit without updating elements/maxprobe.
                     return 0;
                 }
+                ta->dead--;
             }
             memcpy(e, &r, sizeof(struct entry));
+            rh_set_alive(ta, e - ta->table);
             break;
         } else {
             if(e->probepos < r.probepos || (e->probepos == r.probepos && r.hash < e->hash)) {
@@ -240,7 +438,7 @@ int table_insert(table_t t, void *key, size_t keylen, void *data)
                 memcpy(e, &r, sizeof(struct entry));
                 memcpy(&r, &temp, sizeof(struct entry));
                 // Reset step for new record
-                step = ta->step_prime - (r.hash % ta->step_prime);
+                step = rh_step(ta, r.hash);
             } else if(e->probepos == r.probepos && r.hash == e->hash && !strncmp(r.key, e->key, r.keylen)) {
                 // The key already exists, simply update the value
                 e->data = r.data;
@@ -261,12 +459,51 @@ int table_insert(table_t t, void *key, size_t keylen, void *data)
 static ssize_t internal_search(table_t t, void *key, size_t keylen)
 {
     struct table *ta = t;
+
+    if(TRACE_ON(&ta->base)) {
+        unsigned long hash = ta->hash(key, keylen);
+        unsigned int probes;
+        ssize_t pos = search_probes(ta, hash, ta->cmp, key, keylen, &probes);
+        if(ta->base.trace.probe_threshold && probes > ta->base.trace.probe_threshold)
+            table_trace_fire(&ta->base, TABLE_TRACE_LONG_PROBE, key, keylen, hash, probes, 0);
+        return pos;
+    }
+    return rh_search_hash(ta, ta->hash(key, keylen), key, keylen);
+}
+
+/* Prefetch the first slot rh_search_hash will read for hash */
+void rh_prefetch_hash(struct table *ta, unsigned long hash)
+{
+    unsigned long step = rh_step(ta, hash);
+
+    if(ta->elements)
+        __builtin_prefetch(&ta->table[(hash + (ta->totalweight/ta->elements) * step) % ta->size]);
+}
+
+/* Prefetch, for writing, the first slot rh_insert_hash will read */
+void rh_prefetch_insert(struct table *ta, unsigned long hash)
+{
+    __builtin_prefetch(&ta->table[(hash + rh_step(ta, hash)) % ta->size], 1);
+}
+
+/* Slot index of key, or -1. hash must be ta->hash(key, keylen) */
+ssize_t rh_search_hash(struct table *ta, unsigned long hash, void *key, size_t keylen)
+{
+    return search_probes(ta, hash, ta->cmp, key, keylen, NULL);
+}
+
+/* The outward walk behind rh_search_hash. If probes is set it receives
+ * the number of slots examined (both directions of every round)
+ */
+static ssize_t search_probes(struct table *ta, unsigned long hash, cmp_func cmp, void *key, size_t keylen, unsigned int *probes)
+{
     struct entry *e = NULL;
-    unsigned long hash = ta->hash(key, keylen);
-    unsigned long step = ta->step_prime - (hash % ta->step_prime);
+    unsigned long step = rh_step(ta, hash);
     int found = 0, walk = 0, start = 0, topdone = 0, botdone = 0;
     ssize_t pos = -1;
 
+    if(probes)
+        *probes = 0;
     if(ta->elements == 0)
         return -1;
 
@@ -283,7 +520,7 @@ static ssize_t internal_search(table_t t, void *key, size_t keylen)
                 // meaning it either doesn't exist or lives below.
                 topdone = 1;
             } else if(e->alive) {
-                if(!ta->cmp(key, e->key, keylen)) {
+                if(!cmp(key, e->key, keylen)) {
                     found = 1;
                     break;
                 }
@@ -296,7 +533,7 @@ static ssize_t internal_search(table_t t, void *key, size_t keylen)
             pos = (hash + (start - walk) * step) % ta->size;
             e = &ta->table[pos];
             if(e->alive) {
-                if(!ta->cmp(key, e->key, keylen)) {
+                if(!cmp(key, e->key, keylen)) {
                     found = 1;
                     break;
                 }
@@ -311,6 +548,8 @@ static ssize_t internal_search(table_t t, void *key, size_t keylen)
         walk++;
     }
 
+    if(probes)
+        *probes = 2 * walk + 1;
     if(found)
         return pos;
     else
@@ -318,12 +557,12 @@ static ssize_t internal_search(table_t t, void *key, size_t keylen)
 }
 
 /* Fetch a record walking outwards from average to cover probe 1 -> maxprobe */
-int table_get(table_t t, void *key, size_t keylen, void **data_ptr)
+static int rh_get(table_t t, void *key, size_t keylen, void **data_ptr)
 {
     struct table *ta = t;
     ssize_t pos = internal_search(t, key, keylen);
 
-    if(pos > 0) {
+    if(pos >= 0) {
         *data_ptr = ta->table[pos].data;
         return 0;
     } else {
@@ -333,14 +572,16 @@ int table_get(table_t t, void *key, size_t keylen, void **data_ptr)
 }
 
 /* Remove an item. Simply set alive = 0 */
-int table_remove(table_t t, void *key, size_t keylen)
+static int rh_remove(table_t t, void *key, size_t keylen)
 {
     struct table *ta = t;
     ssize_t pos = internal_search(t, key, keylen);
 
-    if(pos > 0) {
+    if(pos >= 0) {
         ta->table[pos].alive = 0;
+        rh_clear_alive(ta, pos);
         ta->elements--;
+        ta->dead++;
         ta->totalweight -= ta->table[pos].probepos;
         return 0;
     } else {
@@ -348,13 +589,48 @@ int table_remove(table_t t, void *key, size_t keylen)
     }
 }
 
+/* Walk the live slots through the bitmap and tombstone matches. Double
+ * hashing leaves no neighbour to shift back into the hole, so this is
+ * table_remove without the searches
+ */
+static size_t rh_erase_if(table_t t, iter_func pred, void *arg, int shrink)
+{
+    struct table *ta = t;
+    size_t pos = rh_next_alive(ta, 0), removed = 0, size;
+
+    for(; pos < ta->size; pos = rh_next_alive(ta, pos + 1)) {
+        struct entry *e = &ta->table[pos];
+        if(!pred(arg, e->key, e->keylen, e->data))
+            continue;
+        e->alive = 0;
+        rh_clear_alive(ta, pos);
+        ta->elements--;
+        ta->dead++;
+        ta->totalweight -= e->probepos;
+        removed++;
+    }
+
+    if(shrink) {
+        size = MAX((size_t)(ta->elements / (ta->max_load / 2)) + 1, TABLE_SIZE_DEFAULT);
+        size = next_prime_size(size, 1);
+        /* a rebuild drops the tombstones too, so one at the same size pays
+         * once enough of them have built up, from this sweep or earlier
+         * removes. Without the memory for it the table keeps its slots and
+         * tombstones, and the next shrinking sweep tries again.
+         */
+        if((size < ta->size || ta->dead >= ta->size / RH_ERASE_REBUILD) && resize_table(t, MIN(size, ta->size)))
+            return removed;
+    }
+    return removed;
+}
+
 /* Fetch key pointer */
-void *table_fetch_key(table_t t, void *key, size_t keylen)
+static void *rh_fetch_key(table_t t, void *key, size_t keylen)
 {
     struct table *ta = t;
     ssize_t pos = internal_search(t, key, keylen);
 
-    if(pos > 0) {
+    if(pos >= 0) {
         return ta->table[pos].key;
     } else {
         return NULL;
@@ -362,12 +638,12 @@ void *table_fetch_key(table_t t, void *key, size_t keylen)
 }
 
 /* Fetch data pointer */
-void *table_fetch_val(table_t t, void *key, size_t keylen)
+static void *rh_fetch_val(table_t t, void *key, size_t keylen)
 {
     struct table *ta = t;
     ssize_t pos = internal_search(t, key, keylen);
 
-    if(pos > 0) {
+    if(pos >= 0) {
         return ta->table[pos].data;
     } else {
         return NULL;
@@ -377,20 +653,530 @@ void *table_fetch_val(table_t t, void *key, size_t keylen)
 /* Iterate over the table, invoking provided function with
  * key, keylen, data, and arg
  */
-int table_iter(table_t t, iter_func f, void *arg)
+static int rh_iter(table_t t, iter_func f, void *arg)
 {
     struct table *ta = t;
-    size_t pos = 0;
+    size_t pos = rh_next_alive(ta, 0);
     struct entry *e = NULL;
     int ret = 0;
 
-    for(; pos < ta->size; pos++) {
+    for(; pos < ta->size; pos = rh_next_alive(ta, pos + 1)) {
         e = &ta->table[pos];
-        if(e->alive) {
-            if((ret = f(arg, e->key, e->keylen, e->data) != 0))
+        if((ret = f(arg, e->key, e->keylen, e->data)) != 0)
+            break;
+    }
+
+    return ret;
+}
+
+static const struct table_ops rh_ops = {
+    .insert = rh_insert,
+    .get = rh_get,
+    .remove = rh_remove,
+    .iter = rh_iter,
+    .fetch_key = rh_fetch_key,
+    .fetch_val = rh_fetch_val,
+    .print_stats = rh_print_stats,
+    .get_stats = rh_get_stats,
+    .free = rh_free,
+    .reserve = rh_reserve,
+    .clone = rh_clone,
+    .probe_counts = rh_probe_counts,
+    .key_probes = rh_key_probes,
+    .find = rh_find,
+    .dump_slots = rh_dump_slots,
+    .insert_batch = rh_insert_batch,
+    .erase_if = rh_erase_if,
+};
+
+/* Resumable lookups. The robin hood walk is the one rh_search_hash does,
+ * split so that each step reads one slot (or one key) that the previous
+ * step prefetched. Other engines answer on the first step.
+ */
+enum { LOOKUP_SLOT, LOOKUP_KEY, LOOKUP_GENERIC, LOOKUP_MISS };
+
+/* Move to the next probe of the outward walk and prefetch its slot.
+ * Returns 0 once both directions are exhausted.
+ */
+static int lookup_advance(struct table_lookup *l)
+{
+    struct table *ta = l->t;
+    long probe;
+
+    for(;;) {
+        if(l->topdone && l->botdone)
+            return 0;
+        if(!l->side) {
+            l->side = 1;
+            if(!l->topdone && l->start + l->walk <= ta->maxprobe) {
+                probe = l->start + l->walk;
+                l->top = 1;
+                break;
+            }
+            l->topdone = 1;
+        } else {
+            l->side = 0;
+            probe = l->start - l->walk;
+            l->walk++;
+            if(!l->botdone && probe >= 1) {
+                l->top = 0;
                 break;
+            }
+            l->botdone = 1;
         }
     }
 
+    l->pos = (l->hash + probe * l->step) % ta->size;
+    l->probes++;
+    __builtin_prefetch(&ta->table[l->pos]);
+    l->state = LOOKUP_SLOT;
+    return 1;
+}
+
+void table_lookup_start(table_t t, struct table_lookup *l, void *key, size_t keylen)
+{
+    struct table *ta = t;
+
+    memset(l, 0, sizeof(*l));
+    l->t = t;
+    l->key = key;
+    l->keylen = keylen;
+
+    if(ta->base.engine != TABLE_ENGINE_ROBIN_HOOD) {
+        l->state = LOOKUP_GENERIC;
+        return;
+    }
+    if(ta->elements == 0) {
+        l->state = LOOKUP_MISS;
+        return;
+    }
+
+    l->hash = ta->hash(key, keylen);
+    l->step = rh_step(ta, l->hash);
+    l->start = ta->totalweight/ta->elements;
+    if(!lookup_advance(l))
+        l->state = LOOKUP_MISS;
+}
+
+/* A robin hood lookup has finished: count, sample and trace it */
+static int lookup_done(struct table_lookup *l, struct entry *e, void **data_ptr)
+{
+    struct table *ta = l->t;
+    struct table_base *tb = &ta->base;
+
+    *data_ptr = e ? e->data : NULL;
+    tb->gets++;
+    tb->get_hits += e != NULL;
+    if(TRACE_ON(tb) && tb->trace.probe_threshold && l->probes > tb->trace.probe_threshold)
+        table_trace_fire(tb, TABLE_TRACE_LONG_PROBE, l->key, l->keylen, l->hash, l->probes, 0);
+    if(tb->sampler && e)
+        sampler_note(tb, l->key, l->keylen);
+    return e ? 0 : -1;
+}
+
+int table_lookup_step(struct table_lookup *l, void **data_ptr)
+{
+    struct table *ta = l->t;
+    struct entry *e;
+
+    switch(l->state) {
+    case LOOKUP_GENERIC:
+        return table_get(l->t, l->key, l->keylen, data_ptr);
+    case LOOKUP_MISS:
+        return lookup_done(l, NULL, data_ptr);
+    case LOOKUP_KEY:
+        e = &ta->table[l->pos];
+        if(!ta->cmp(l->key, e->key, l->keylen))
+            return lookup_done(l, e, data_ptr);
+        break;
+    default:
+        e = &ta->table[l->pos];
+        if(l->top && e->key == NULL) {
+            // Nothing ever reached this slot, see rh_search_hash
+            l->topdone = 1;
+        } else if(e->alive && e->hash == l->hash) {
+            // Likely hit: fetch the key before comparing
+            __builtin_prefetch(e->key);
+            l->state = LOOKUP_KEY;
+            return TABLE_LOOKUP_PENDING;
+        }
+        break;
+    }
+
+    if(lookup_advance(l))
+        return TABLE_LOOKUP_PENDING;
+    return lookup_done(l, NULL, data_ptr);
+}
+
+/* Public API: dispatch to the engine the table was created with */
+
+static const char *engine_names[TABLE_ENGINE_COUNT] = {
+    "robinhood", "cuckoo", "hopscotch", "auto"
+};
+
+const char *table_engine_name(enum table_engine e)
+{
+    return e < TABLE_ENGINE_COUNT ? engine_names[e] : "unknown";
+}
+
+/* table_new_ex builds a table with the requested engine. NULL hash/cmp
+ * select the built-in string hash and compare, zero max_load/growth the
+ * engine's own. A max_load of 1 or more or a growth of 1 or less is
+ * refused
+ */
+table_t table_new_ex(const struct table_config *cfg)
+{
+    struct table_config c = *cfg;
+    table_t t;
+
+    c.hash = c.hash?c.hash:table_hash;
+    c.cmp = c.cmp?c.cmp:table_cmp;
+    if(c.max_load < 0 || c.max_load >= 1 || (c.growth && c.growth <= 1))
+        return NULL;
+
+    switch(c.engine) {
+    case TABLE_ENGINE_ROBIN_HOOD:
+        t = rh_new(&c);
+        break;
+    case TABLE_ENGINE_CUCKOO:
+        t = cuckoo_new(&c);
+        break;
+    case TABLE_ENGINE_HOPSCOTCH:
+        t = hopscotch_new(&c);
+        break;
+    case TABLE_ENGINE_AUTO:
+        t = auto_new(&c);
+        break;
+    default:
+        return NULL;
+    }
+
+    if(t) {
+        ((struct table_base *)t)->hash = c.hash;
+        ((struct table_base *)t)->cmp = c.cmp;
+    }
+    return t;
+}
+
+/* table_new generates a new robin hood table at the default size
+ * it takes optionally a hashing function and a compare
+ * function. By default it uses string keys and double hashing
+ */
+table_t table_new(hash_func h, cmp_func c)
+{
+    struct table_config cfg = { TABLE_ENGINE_ROBIN_HOOD, h, c };
+    return table_new_ex(&cfg);
+}
+
+void table_free(table_t t)
+{
+    struct table_base *tb = t;
+    if(tb) {
+        table_sampler_disable(t);
+        tb->ops->free(t);
+    }
+}
+
+/* Traced form of the dispatch calls: time the op and report a grow
+ * (seen as grow time accrued during the call) or a slow call
+ */
+static int traced_insert(struct table_base *tb, void *key, size_t keylen, void *data)
+{
+    unsigned long long grown = tb->grow_ns, start = table_now_ns(), ns;
+    int ret = tb->ops->insert(tb, key, keylen, data);
+
+    ns = table_now_ns() - start;
+    if(tb->grow_ns != grown)
+        table_trace_fire(tb, TABLE_TRACE_GROW, key, keylen, tb->hash(key, keylen), 0, ns);
+    else
+        table_trace_check(tb, TABLE_TRACE_SLOW, key, keylen, 0, 0, ns);
+    return ret;
+}
+
+static void traced_done(struct table_base *tb, void *key, size_t keylen, unsigned long long start)
+{
+    table_trace_check(tb, TABLE_TRACE_SLOW, key, keylen, 0, 0, table_now_ns() - start);
+}
+
+/* table_insert adds a new element to the table if it doesn't already exist.
+ * returns 0 on success, non-zero error
+ */
+int table_insert(table_t t, void *key, size_t keylen, void *data)
+{
+    struct table_base *tb = t;
+    int ret;
+
+    tb->inserts++;
+    if(TRACE_ON(tb))
+        ret = traced_insert(tb, key, keylen, data);
+    else
+        ret = tb->ops->insert(t, key, keylen, data);
+    if(tb->sampler && !ret)
+        sampler_note(tb, key, keylen);
+    return ret;
+}
+
+/* table_insert with the hash already worked out by the caller. Robin
+ * hood places the entry under it directly; the other engines, and a
+ * traced table, hash again through table_insert
+ */
+int table_insert_hashed(table_t t, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    struct table_base *tb = t;
+    int ret;
+
+    if(tb->engine != TABLE_ENGINE_ROBIN_HOOD || TRACE_ON(tb))
+        return table_insert(t, key, keylen, data);
+    tb->inserts++;
+    ret = rh_insert_hash(t, hash, key, keylen, data);
+    if(tb->sampler && !ret)
+        sampler_note(tb, key, keylen);
+    return ret;
+}
+
+/* The engine's batched placement, which sizes the table as it goes.
+ * Traced or sampled tables take the per-item path so every insert is
+ * still seen
+ */
+int table_insert_batch(table_t t, void **keys, const size_t *keylens, void **datas, size_t n, int *results)
+{
+    struct table_base *tb = t;
+    size_t i, failed = 0;
+    int ret;
+
+    if(tb->ops->insert_batch && !TRACE_ON(tb) && !tb->sampler) {
+        tb->inserts += n;
+        return tb->ops->insert_batch(t, keys, keylens, datas, n, results);
+    }
+
+    for(i = 0; i < n; i++) {
+        ret = table_insert(t, keys[i], keylens[i], datas[i]);
+        if(results)
+            results[i] = ret;
+        failed += ret != 0;
+    }
+    return failed ? -1 : 0;
+}
+
+int table_get(table_t t, void *key, size_t keylen, void **data_ptr)
+{
+    struct table_base *tb = t;
+    unsigned long long start = TRACE_ON(tb) ? table_now_ns() : 0;
+    int ret = tb->ops->get(t, key, keylen, data_ptr);
+    tb->gets++;
+    tb->get_hits += !ret;
+    if(TRACE_ON(tb))
+        traced_done(tb, key, keylen, start);
+    if(tb->sampler && !ret)
+        sampler_note(tb, key, keylen);
+    return ret;
+}
+
+/* ops->find with a get's counting, tracing and sampling. key is what
+ * cmp is handed; note is the same key as plain bytes, for the trace hook
+ * and the sampler, and is only read when one of them is on
+ */
+int table_find_noted(struct table_base *tb, unsigned long hash, cmp_func cmp, void *key,
+                     size_t keylen, void **data_ptr, void *note)
+{
+    unsigned long long start = TRACE_ON(tb) ? table_now_ns() : 0;
+    int ret = tb->ops->find(tb, hash, cmp, key, keylen, data_ptr);
+    tb->gets++;
+    tb->get_hits += !ret;
+    if(TRACE_ON(tb))
+        traced_done(tb, note, keylen, start);
+    if(tb->sampler && !ret)
+        sampler_note(tb, note, keylen);
     return ret;
 }
+
+/* table_get with the hash already worked out by the caller */
+int table_get_hashed(table_t t, unsigned long hash, void *key, size_t keylen, void **data_ptr)
+{
+    struct table_base *tb = t;
+    return table_find_noted(tb, hash, tb->cmp, key, keylen, data_ptr, key);
+}
+
+int table_remove(table_t t, void *key, size_t keylen)
+{
+    struct table_base *tb = t;
+    unsigned long long start = TRACE_ON(tb) ? table_now_ns() : 0;
+    int ret = tb->ops->remove(t, key, keylen);
+    tb->removes++;
+    if(TRACE_ON(tb))
+        traced_done(tb, key, keylen, start);
+    return ret;
+}
+
+size_t table_erase_if(table_t t, iter_func pred, void *arg, int flags)
+{
+    struct table_base *tb = t;
+    size_t removed = tb->ops->erase_if(t, pred, arg, flags & TABLE_ERASE_SHRINK);
+    tb->erased += removed;
+    return removed;
+}
+
+int table_iter(table_t t, iter_func f, void *arg)
+{
+    struct table_base *tb = t;
+    return tb->ops->iter(t, f, arg);
+}
+
+void *table_fetch_key(table_t t, void *key, size_t keylen)
+{
+    struct table_base *tb = t;
+    return tb->ops->fetch_key(t, key, keylen);
+}
+
+void *table_fetch_val(table_t t, void *key, size_t keylen)
+{
+    struct table_base *tb = t;
+    return tb->ops->fetch_val(t, key, keylen);
+}
+
+int table_dump_slots(table_t t, struct table_slot *slots, size_t *n)
+{
+    struct table_base *tb = t;
+    size_t room = slots ? *n : 0;
+
+    *n = tb->ops->dump_slots(t, slots, room);
+    return *n <= room ? 0 : -1;
+}
+
+void table_print_stats(table_t t)
+{
+    struct table_base *tb = t;
+    tb->ops->print_stats(t);
+}
+
+table_t table_clone(table_t t)
+{
+    struct table_base *tb = t, *c = tb->ops->clone(t);
+    /* the sampler belongs to the source table */
+    if(c)
+        c->sampler = NULL;
+    return c;
+}
+
+int table_reserve(table_t t, size_t n)
+{
+    struct table_base *tb = t;
+    return tb->ops->reserve(t, n);
+}
+
+int table_get_stats(table_t t, struct table_stats *st)
+{
+    struct table_base *tb = t;
+    if(!tb || !st)
+        return -1;
+    if(tb->ops->get_stats(t, st))
+        return -1;
+    st->engine = tb->engine;
+    st->grow_ns = tb->grow_ns;
+    st->inserts = tb->inserts;
+    st->gets = tb->gets;
+    st->get_hits = tb->get_hits;
+    st->removes = tb->removes;
+    st->erased = tb->erased;
+    return 0;
+}
+
+int table_set_trace(table_t t, trace_func f, void *arg, unsigned int probe_threshold, unsigned long long ns_threshold)
+{
+#ifdef TABLE_TRACE
+    struct table_base *tb = t;
+    tb->trace.fn = f;
+    tb->trace.arg = arg;
+    tb->trace.probe_threshold = probe_threshold;
+    tb->trace.ns_threshold = ns_threshold;
+    if(tb->engine == TABLE_ENGINE_AUTO)
+        auto_set_trace(t);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void table_trace_fire(struct table_base *tb, enum table_trace_kind kind, const void *key,
+                      size_t keylen, unsigned long hash, unsigned int probes, unsigned long long ns)
+{
+    struct table_trace_event ev;
+
+    ev.kind = kind;
+    ev.key = key;
+    ev.keylen = keylen;
+    ev.hash = hash ? hash : tb->hash((void *)key, keylen);
+    ev.probes = probes;
+    ev.ns = ns;
+    tb->trace.fn(tb->trace.arg, &ev);
+}
+
+void table_trace_check(struct table_base *tb, enum table_trace_kind kind, const void *key,
+                       size_t keylen, unsigned long hash, unsigned int probes, unsigned long long ns)
+{
+    if((tb->trace.probe_threshold && probes >= tb->trace.probe_threshold) ||
+       (tb->trace.ns_threshold && ns >= tb->trace.ns_threshold))
+        table_trace_fire(tb, kind, key, keylen, hash, probes, ns);
+}
+
+unsigned long long table_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Overflow list shared by the engines that can fail to place a key */
+struct overflow_entry *overflow_find(struct overflow *o, cmp_func cmp, unsigned long hash, void *key, size_t keylen)
+{
+    size_t i = 0;
+    for(; i < o->n; i++) {
+        if(o->e[i].hash == hash && !cmp(key, o->e[i].key, keylen))
+            return &o->e[i];
+    }
+    return NULL;
+}
+
+/* Make sure the next overflow_add cannot fail */
+int overflow_room(struct overflow *o)
+{
+    if(o->n == o->cap) {
+        size_t cap = o->cap ? o->cap * 2 : 8;
+        struct overflow_entry *e = realloc(o->e, cap * sizeof(*e));
+        if(!e)
+            return -1;
+        o->e = e;
+        o->cap = cap;
+    }
+    return 0;
+}
+
+int overflow_add(struct overflow *o, unsigned long hash, void *key, size_t keylen, void *data)
+{
+    if(overflow_room(o))
+        return -1;
+    o->e[o->n].hash = hash;
+    o->e[o->n].key = key;
+    o->e[o->n].keylen = keylen;
+    o->e[o->n].data = data;
+    o->n++;
+    return 0;
+}
+
+void overflow_del(struct overflow *o, struct overflow_entry *e)
+{
+    *e = o->e[--o->n];
+}
+
+int overflow_copy(struct overflow *dst, const struct overflow *src)
+{
+    memset(dst, 0, sizeof(*dst));
+    if(!src->n)
+        return 0;
+    dst->e = malloc(src->n * sizeof(*dst->e));
+    if(!dst->e)
+        return -1;
+    memcpy(dst->e, src->e, src->n * sizeof(*dst->e));
+    dst->n = dst->cap = src->n;
+    return 0;
+}
@@ -2,6 +2,11 @@
 #define _TABLE_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef void* table_t;
 typedef int(*cmp_func)(void*, void*, size_t);
@@ -9,20 +14,373 @@ typedef unsigned long(*hash_func)(void*, size_t);
                       /*arg,    key,   keylen, data */
 typedef int(*iter_func)(void *, void*, size_t, void*);
 
+/* Collision resolution engines, all behind the same API */
+enum table_engine {
+    TABLE_ENGINE_ROBIN_HOOD,    /* default: robin hood with double hashing */
+    TABLE_ENGINE_CUCKOO,        /* bucketised cuckoo, two 4-way buckets per key */
+    TABLE_ENGINE_HOPSCOTCH,     /* hopscotch, 32-slot neighbourhood bitmaps */
+    TABLE_ENGINE_AUTO,          /* picks one of the above from the observed op mix and hit rate */
+    TABLE_ENGINE_COUNT
+};
+
+/* Robin hood probe sequence */
+enum table_probe {
+    TABLE_PROBE_DOUBLE,         /* default: double hashing, stride from the hash */
+    TABLE_PROBE_LINEAR,         /* stride 1, adjacent slots share cache lines */
+};
+
+struct table_config {
+    enum table_engine engine;
+    hash_func hash;             /* NULL for the built-in string hash */
+    cmp_func cmp;               /* NULL for the built-in string compare */
+    enum table_probe probe;
+    float max_load;             /* grow past this load, 0 for the engine's default */
+    float growth;               /* size multiplier per grow, 0 for the engine's default;
+                                 * cuckoo and hopscotch round it to a power of two */
+};
+
 table_t table_new(hash_func h, cmp_func c);
+table_t table_new_ex(const struct table_config *cfg);
+void table_free(table_t);
 
 int table_insert(table_t, void *key, size_t keylen, void *data);
 
+/* Insert (or update) n items at once: robin hood tables reserve room for
+ * a run of keys at a time and hash the run before placing it, prefetching
+ * each key's first slot a few items ahead. results[i], if
+ * results is not NULL, gets what table_insert would have returned for
+ * item i. Returns 0 if every item went in, -1 otherwise.
+ */
+int table_insert_batch(table_t, void **keys, const size_t *keylens, void **datas, size_t n, int *results);
+
 int table_get(table_t, void *key, size_t keylen, void **dataptr);
 
 int table_remove(table_t, void *key, size_t keylen);
 
+/* Remove every entry pred returns non-zero for, in one sweep over the
+ * slots; pred must not modify the table. Robin hood leaves tombstones as
+ * table_remove does. With TABLE_ERASE_SHRINK the table is then rebuilt
+ * at the smallest size (not below the default) that leaves it at most
+ * half its max load, which also clears the tombstones; robin hood also
+ * rebuilds at the same size once tombstones, from the sweep or earlier
+ * removes, fill a quarter of the slots. If the rebuild fails the table
+ * stays as it is.
+ * Returns the number of entries removed, which are counted in erased
+ * rather than removes.
+ */
+#define TABLE_ERASE_SHRINK 1
+
+size_t table_erase_if(table_t, iter_func pred, void *arg, int flags);
+
+/* Lookup by a key given in parts (e.g. tenant, type, name), matching the
+ * key that is the parts' concatenation. With the built-in hash and
+ * compare the parts are hashed and compared in place; otherwise they are
+ * concatenated first.
+ */
+struct table_keypart {
+    const void *base;
+    size_t len;
+};
+
+int table_get_parts(table_t, const struct table_keypart *parts, int nparts, void **dataptr);
+
+/* Incremental form of the built-in hash, for keys that arrive in pieces
+ * (parsed out of a network buffer, say): init, any number of updates,
+ * then final gives what the built-in hash gives over the same bytes.
+ * table_get_hashed and table_insert_hashed look up or add a key under a
+ * hash the caller already has, which must be what the table's hash
+ * function returns for that key.
+ */
+struct table_hasher {
+    unsigned long h;
+};
+
+void table_hasher_init(struct table_hasher *);
+void table_hasher_update(struct table_hasher *, const void *buf, size_t len);
+unsigned long table_hasher_final(const struct table_hasher *);
+
+int table_get_hashed(table_t, unsigned long hash, void *key, size_t keylen, void **dataptr);
+int table_insert_hashed(table_t, unsigned long hash, void *key, size_t keylen, void *data);
+
 int table_iter(table_t, iter_func, void*);
 
+/* Iterate in an order independent of slot placement: by hash (ties by
+ * key), or by key bytes (memcmp order, shorter first on a common prefix).
+ * nthreads > 1 sorts key order on that many threads. Returns -1 if the
+ * sort cannot allocate; f returning non-zero stops the walk, and as with
+ * table_iter that value is returned.
+ */
+enum table_order {
+    TABLE_ORDER_HASH,
+    TABLE_ORDER_KEY,
+};
+
+int table_iter_sorted(table_t, enum table_order order, iter_func f, void *arg, unsigned int nthreads);
+
+/* Resumable lookup, for callers that interleave many lookups to hide
+ * memory latency (see table_coro.hpp). table_lookup_step does one probe
+ * and, when it cannot finish yet, prefetches the memory the next step
+ * reads and returns TABLE_LOOKUP_PENDING. Between steps the caller works
+ * on other lookups. The final step returns 0 (found, *dataptr set) or -1,
+ * and counts, samples and traces the lookup as table_get would (the trace
+ * reports long probes only: a lookup's time is shared with the others).
+ * The table must not be modified while a lookup is in flight.
+ */
+#define TABLE_LOOKUP_PENDING 1
+
+struct table_lookup {
+    /* private */
+    table_t t;
+    void *key;
+    size_t keylen;
+    unsigned long hash;
+    unsigned long step;
+    size_t pos;
+    long start;
+    long walk;
+    unsigned int probes;
+    unsigned char state;
+    unsigned char side;
+    unsigned char top;
+    unsigned char topdone;
+    unsigned char botdone;
+};
+
+void table_lookup_start(table_t, struct table_lookup *, void *key, size_t keylen);
+int table_lookup_step(struct table_lookup *, void **dataptr);
+
+/* Copy of the table at the same size. Keys and data are borrowed, so the
+ * clone points at the same key/data memory as the original
+ */
+table_t table_clone(table_t);
+
+/* Pre-size the table so that n more inserts will not trigger a grow */
+int table_reserve(table_t, size_t n);
+
 void *table_fetch_key(table_t, void *key, size_t keylen);
 void *table_fetch_val(table_t, void *key, size_t keylen);
 
+/* Set algebra. Results are inserted into out, which must be neither input
+ * and can be pre-sized with table_reserve. Values come from a (union takes
+ * values of keys only in b from b). nthreads > 1 splits the scan across
+ * threads when both inputs are robin hood tables with the same hash, and
+ * union's copy of a whenever a is a robin hood table.
+ */
+int table_union(table_t out, table_t a, table_t b, unsigned int nthreads);
+int table_intersect(table_t out, table_t a, table_t b, unsigned int nthreads);
+int table_difference(table_t out, table_t a, table_t b, unsigned int nthreads);
+
 /* Diagnostics */
+struct table_stats {
+    enum table_engine engine;
+    size_t size;            /* slots allocated */
+    size_t elements;        /* live entries */
+    size_t memory;          /* bytes held by the table itself (keys/data are borrowed) */
+    unsigned long totalweight;
+    unsigned int maxprobe;
+    unsigned long grows;            /* grow_table calls since table_new */
+    unsigned long recycle_searches; /* inserts into a dead slot that had to search for the key */
+    unsigned long long grow_ns;     /* total time spent growing */
+    unsigned long inserts;          /* table_insert/table_get/table_remove calls */
+    unsigned long gets;
+    unsigned long get_hits;
+    unsigned long removes;
+    unsigned long erased;           /* entries removed by table_erase_if */
+};
+
 void table_print_stats(table_t);
+int table_get_stats(table_t, struct table_stats *);
+const char *table_engine_name(enum table_engine);
+
+/* Slot-level layout, for tuning tools: one record per slot in slot
+ * order, probe being the entry's probe length on the scale of the
+ * metrics probe histogram. Cuckoo and hopscotch entries on the overflow
+ * list have no slot and are left out. *n is the room in slots on entry
+ * and the slot count on return; -1 if they did not fit (slots may be
+ * NULL to ask for the count).
+ */
+enum table_slot_state {
+    TABLE_SLOT_EMPTY,
+    TABLE_SLOT_ALIVE,
+    TABLE_SLOT_DEAD,            /* robin hood tombstone */
+};
+
+struct table_slot {
+    unsigned long hash;
+    unsigned int probe;
+    unsigned char state;
+};
+
+int table_dump_slots(table_t, struct table_slot *slots, size_t *n);
+
+/* Slow-operation tracing. Only built into the library with TABLE_TRACE
+ * defined (make TRACE=1); otherwise the checks compile away and
+ * table_set_trace returns -1.
+ *
+ * The hook fires for an insert that had to grow the table, a lookup
+ * (get/remove/fetch) that examined more than probe_threshold slots, a
+ * recycled-slot search at or over either threshold, and any other call
+ * that took at least ns_threshold. A threshold of 0 disables that test.
+ * The event's key points at the caller's key and is only valid in the
+ * hook; probes counts the slots examined (for cuckoo and hopscotch,
+ * overflow entries walked included), ns is 0 where not timed.
+ */
+enum table_trace_kind {
+    TABLE_TRACE_GROW,
+    TABLE_TRACE_LONG_PROBE,
+    TABLE_TRACE_RECYCLE,
+    TABLE_TRACE_SLOW,
+};
+
+struct table_trace_event {
+    enum table_trace_kind kind;
+    const void *key;
+    size_t keylen;
+    unsigned long hash;
+    unsigned int probes;
+    unsigned long long ns;
+};
+
+typedef void(*trace_func)(void *arg, const struct table_trace_event *);
+
+int table_set_trace(table_t, trace_func f, void *arg, unsigned int probe_threshold, unsigned long long ns_threshold);
+
+/* Hot-key and long-probe sampling. Once enabled, one in 2^rate_shift
+ * successful gets and inserts is fed to a count-min sketch, and the table
+ * keeps the k keys with the highest estimated access counts and the k
+ * longest-probing keys it has sampled. Sampled keys are copied, so they
+ * outlive the caller's key; the long-probe list records the probe length
+ * when last sampled and may go stale as the table grows.
+ *
+ * table_sampler_hot and table_sampler_long_probes fill out with up to n
+ * samples, highest first, and return how many. count is the estimated
+ * number of accesses (scaled by the sampling rate) or the probe length.
+ * The keys point into the sampler and are valid until the next call on
+ * the table.
+ */
+struct table_sample {
+    const void *key;
+    size_t keylen;
+    unsigned long count;
+};
+
+int table_sampler_enable(table_t, unsigned int k, unsigned int rate_shift);
+void table_sampler_disable(table_t);
+size_t table_sampler_hot(table_t, struct table_sample *out, size_t n);
+size_t table_sampler_long_probes(table_t, struct table_sample *out, size_t n);
+
+/* Multi-version tables. Writes commit one at a time as increasing
+ * version numbers; a reader opens a snapshot and passes it to
+ * table_mvcc_get to see the table as of that version, however many
+ * writes follow, until it closes the snapshot. Closing a snapshot
+ * collects the versions no open snapshot can reach, and with no snapshot
+ * open a write frees the version it replaces; table_mvcc_gc does the
+ * same on demand and returns the number of versions freed.
+ * Keys are copied; data pointers are borrowed. Calls need the same
+ * serialisation as any table, but a snapshot is stable across them.
+ */
+typedef void* mvcc_t;
+
+mvcc_t table_mvcc_new(const struct table_config *cfg);
+void table_mvcc_free(mvcc_t);
+int table_mvcc_put(mvcc_t, void *key, size_t keylen, void *data);
+int table_mvcc_del(mvcc_t, void *key, size_t keylen);
+int table_mvcc_get(mvcc_t, void *key, size_t keylen, unsigned long snap, void **dataptr);
+unsigned long table_mvcc_version(mvcc_t);
+int table_snapshot_open(mvcc_t, unsigned long *snap);
+void table_snapshot_close(mvcc_t, unsigned long snap);
+size_t table_mvcc_gc(mvcc_t);
+
+/* Apply a batch of puts and deletes as one commit: every op lands at the
+ * same new version, so no snapshot sees part of it. A later op on the
+ * same key wins. Returns -1 and changes nothing if any op fails (a
+ * delete of an absent key, or out of memory).
+ */
+enum table_mvcc_op_kind {
+    TABLE_MVCC_PUT,
+    TABLE_MVCC_DEL,
+};
+
+struct table_mvcc_op {
+    enum table_mvcc_op_kind op;
+    void *key;
+    size_t keylen;
+    void *data;
+};
+
+int table_mvcc_apply(mvcc_t, const struct table_mvcc_op *ops, size_t n);
+
+/* Streaming top-k (space-saving). Tracks at most k keys in fixed memory;
+ * count overestimates a key's true frequency by at most error. Keys are
+ * copied. table_topk_add_batch adds each key once with its lookups
+ * interleaved. table_topk_list fills out with up to n items, most
+ * frequent first; the keys are valid until the next add.
+ */
+typedef void* topk_t;
+
+struct table_topk_item {
+    const void *key;
+    size_t keylen;
+    unsigned long count;
+    unsigned long error;
+};
+
+topk_t table_topk_new(size_t k, const struct table_config *cfg);
+void table_topk_free(topk_t);
+int table_topk_add(topk_t, void *key, size_t keylen, unsigned long weight);
+int table_topk_add_batch(topk_t, void **keys, const size_t *keylens, size_t n);
+size_t table_topk_list(topk_t, struct table_topk_item *out, size_t n);
+
+/* Sliding-window per-key counters: counts over the last buckets * width
+ * time units, kept as a ring of buckets per key. Times are in any
+ * monotonic unit the caller likes (the same one as width). Keys are
+ * copied. Keys with nothing left in the window are reclaimed a few per
+ * add; table_window_reclaim checks up to budget more and returns how
+ * many it freed.
+ */
+typedef void* window_t;
+
+window_t table_window_new(unsigned int buckets, unsigned long long width, const struct table_config *cfg);
+void table_window_free(window_t);
+int table_window_add(window_t, void *key, size_t keylen, unsigned long n, unsigned long long time);
+unsigned long table_window_count(window_t, void *key, size_t keylen, unsigned long long time);
+size_t table_window_reclaim(window_t, size_t budget, unsigned long long time);
+size_t table_window_keys(window_t);
+
+/* Columnar export. Fills the caller's arrays in one pass over the table,
+ * with keys laid out as an Arrow LargeBinary column: key i is
+ * keys[offsets[i] .. offsets[i+1]). hashes, values, or keys together
+ * with offsets (rows + 1 entries) may be NULL to skip that column.
+ * rows and key_bytes give the capacities going in and what was written
+ * coming out; if either is too small nothing is written, they are set to
+ * what is needed and -1 is returned. nthreads > 1 splits robin hood
+ * tables across threads.
+ */
+struct table_columns {
+    size_t rows;
+    size_t key_bytes;
+    unsigned long *hashes;
+    int64_t *offsets;
+    char *keys;
+    void **values;
+};
+
+int table_export_columns(table_t, struct table_columns *cols, unsigned int nthreads);
+
+/* Render the table's statistics (sizes, load, memory, grows, operation
+ * counters and a probe length histogram) in Prometheus text exposition
+ * format into buf. labels is a label list without braces, e.g.
+ * `table="sessions",shard="3"`, added to every sample; NULL for none.
+ * Returns the length of the full output like snprintf, so a return >= len
+ * means buf was too small (the output is truncated but terminated), or
+ * -1 if the per-table snapshots cannot be allocated (buf is then empty).
+ * The _many form renders several tables with each metric family grouped.
+ */
+int table_metrics_prometheus(table_t, const char *labels, char *buf, size_t len);
+int table_metrics_prometheus_many(table_t *tables, const char **labels, size_t n, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
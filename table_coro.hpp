@@ -0,0 +1,131 @@
+#ifndef _TABLE_CORO_HPP
+#define _TABLE_CORO_HPP
+
+/* C++20 coroutine interleaving of table lookups.
+ *
+ * A lookup that misses cache spends most of its time waiting for the slot
+ * line. Here each lookup runs as a coroutine over table_lookup_step: after
+ * a step prefetches the next slot (or key) it suspends, and a round-robin
+ * scheduler resumes the other in-flight lookups in the meantime, so by the
+ * time a lookup is resumed its line has likely arrived.
+ *
+ * The scheduler keeps `group` worker coroutines alive for a whole run, each
+ * pulling queued lookups in turn, so frames are allocated per run rather
+ * than per lookup.
+ *
+ *     table_coro::interleaver il(t, 8);
+ *     il.submit(key, keylen, &data, &ret);   // as requests arrive
+ *     ...
+ *     il.run();                              // resolves everything queued
+ */
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "table.h"
+
+namespace table_coro {
+
+/* Coroutine handle owner: starts suspended, resumed by the scheduler */
+class task {
+public:
+    struct promise_type {
+        task get_return_object() { return task(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    using handle = std::coroutine_handle<promise_type>;
+
+    explicit task(handle h) : h_(h) {}
+    task(task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task() { if(h_) h_.destroy(); }
+
+    bool done() const { return h_.done(); }
+    void resume() { h_.resume(); }
+
+private:
+    handle h_;
+};
+
+class interleaver {
+public:
+    interleaver(table_t t, std::size_t group) : t_(t), group_(group ? group : 1) {}
+
+    /* Queue a lookup. *ret gets 0 (found, *data set) or -1 after run() */
+    void submit(void *key, std::size_t keylen, void **data, int *ret)
+    {
+        queue_.push_back({key, keylen, data, ret});
+    }
+
+    /* Resolve everything submitted so far */
+    void run()
+    {
+        std::vector<task> workers;
+        std::size_t n = queue_.size() < group_ ? queue_.size() : group_, live;
+
+        next_ = 0;
+        workers.reserve(n);
+        for(std::size_t i = 0; i < n; i++)
+            workers.push_back(worker());
+
+        do {
+            live = 0;
+            for(auto &w : workers) {
+                if(!w.done()) {
+                    w.resume();
+                    live++;
+                }
+            }
+        } while(live);
+
+        queue_.clear();
+    }
+
+private:
+    struct request {
+        void *key;
+        std::size_t keylen;
+        void **data;
+        int *ret;
+    };
+
+    task worker()
+    {
+        while(next_ < queue_.size()) {
+            request r = queue_[next_++];
+            struct table_lookup l;
+            int ret;
+
+            table_lookup_start(t_, &l, r.key, r.keylen);
+            co_await std::suspend_always{};
+            while((ret = table_lookup_step(&l, r.data)) == TABLE_LOOKUP_PENDING)
+                co_await std::suspend_always{};
+            *r.ret = ret;
+        }
+    }
+
+    table_t t_;
+    std::size_t group_;
+    std::size_t next_ = 0;
+    std::vector<request> queue_;
+};
+
+/* One-shot helper: look up n keys with `group` lookups in flight */
+inline void get_many(table_t t, void *const *keys, const std::size_t *keylens, std::size_t n,
+                     void **datas, int *rets, std::size_t group)
+{
+    interleaver il(t, group);
+    for(std::size_t i = 0; i < n; i++)
+        il.submit(keys[i], keylens[i], &datas[i], &rets[i]);
+    il.run();
+}
+
+}
+
+#endif
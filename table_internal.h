@@ -0,0 +1,210 @@
+#ifndef _TABLE_INTERNAL_H
+#define _TABLE_INTERNAL_H
+
+#include <sys/types.h>
+
+#include "table.h"
+
+/* Every engine implements these over its own table struct. The public
+ * functions in table.c dispatch through the ops pointer, which is the
+ * first member of every engine's table.
+ */
+struct table_ops {
+    int (*insert)(table_t, void *key, size_t keylen, void *data);
+    int (*get)(table_t, void *key, size_t keylen, void **dataptr);
+    int (*remove)(table_t, void *key, size_t keylen);
+    int (*iter)(table_t, iter_func, void *);
+    void *(*fetch_key)(table_t, void *key, size_t keylen);
+    void *(*fetch_val)(table_t, void *key, size_t keylen);
+    void (*print_stats)(table_t);
+    int (*get_stats)(table_t, struct table_stats *);
+    void (*free)(table_t);
+    int (*reserve)(table_t, size_t n);
+    table_t (*clone)(table_t);
+    /* counts[p] += entries at probe length p, lengths >= n land in n-1 */
+    void (*probe_counts)(table_t, unsigned long *counts, size_t n);
+    /* probe length of one key on the probe_counts scale, -1 if absent */
+    int (*key_probes)(table_t, void *key, size_t keylen);
+    /* get with a known hash and the caller's compare, called as
+     * cmp(key, stored key, keylen)
+     */
+    int (*find)(table_t, unsigned long hash, cmp_func cmp, void *key, size_t keylen, void **dataptr);
+    /* slot count; fills slots[] too when it has room for them all */
+    size_t (*dump_slots)(table_t, struct table_slot *slots, size_t n);
+    /* NULL where one insert per item is as good; -1 if any item failed */
+    int (*insert_batch)(table_t, void **keys, const size_t *keylens, void **datas, size_t n, int *results);
+    /* remove what pred matches, then shrink if asked; returns the count */
+    size_t (*erase_if)(table_t, iter_func pred, void *arg, int shrink);
+};
+
+struct table_tracer {
+    trace_func fn;
+    void *arg;
+    unsigned int probe_threshold;
+    unsigned long long ns_threshold;
+};
+
+/* Counters kept by the dispatch layer, plus time spent resizing which
+ * each engine adds around its rebuild
+ */
+struct table_base {
+    const struct table_ops *ops;
+    enum table_engine engine;
+    unsigned long inserts;
+    unsigned long gets;
+    unsigned long get_hits;
+    unsigned long removes;
+    unsigned long erased;
+    unsigned long long grow_ns;
+    hash_func hash;         /* the engine's hash and compare, for the dispatch layer */
+    cmp_func cmp;
+    struct table_tracer trace;
+    struct table_sampler *sampler;  /* sampler.c, NULL when off */
+};
+
+unsigned long long table_now_ns(void);
+
+/* The built-in string hash (djb2) and compare (strncmp) */
+unsigned long table_hash(void *k, size_t len);
+int table_cmp(void *k1, void *k2, size_t len);
+
+/* Tracing checks are constant false unless built with TABLE_TRACE, so
+ * every `if(TRACE_ON(tb))` block is dropped by the compiler
+ */
+#ifdef TABLE_TRACE
+#define TRACE_ON(tb) ((tb)->trace.fn != NULL)
+#else
+#define TRACE_ON(tb) 0
+#endif
+
+/* Fire the hook if probes or ns reach the configured thresholds */
+void table_trace_check(struct table_base *tb, enum table_trace_kind kind, const void *key,
+                       size_t keylen, unsigned long hash, unsigned int probes, unsigned long long ns);
+void table_trace_fire(struct table_base *tb, enum table_trace_kind kind, const void *key,
+                      size_t keylen, unsigned long hash, unsigned int probes, unsigned long long ns);
+
+/* Feed one successful access to the sampler; tb->sampler is set */
+void sampler_note(struct table_base *tb, void *key, size_t keylen);
+
+/* A get through ops->find, counted, traced and sampled like table_get;
+ * note is the key as contiguous bytes for the trace hook and sampler
+ */
+int table_find_noted(struct table_base *tb, unsigned long hash, cmp_func cmp, void *key,
+                     size_t keylen, void **data_ptr, void *note);
+
+/* Power of two engines grow by 2^shift; the shift nearest a requested
+ * growth factor, at least 1
+ */
+static inline unsigned int table_grow_shift(float growth)
+{
+    unsigned int shift = 1;
+    while(shift < 8 && growth >= 1.5f * (1u << shift))
+        shift++;
+    return shift;
+}
+
+/* Robin hood engine, table.c */
+struct entry {
+    unsigned long hash;
+    void *key;
+    void *data;
+    size_t keylen;
+    unsigned int probepos;
+    unsigned int alive;
+};
+
+struct table {
+    struct table_base base;
+    struct entry *table;
+    uint64_t *alivemap;     /* one bit per slot, set while the slot is alive */
+    size_t size;
+    size_t step_prime;
+    int linear;             /* TABLE_PROBE_LINEAR */
+    float max_load;
+    float growth;
+    unsigned int totalweight;
+    unsigned int maxprobe;
+    unsigned int elements;
+    unsigned int dead;      /* tombstones: slots keeping a key that is no longer alive */
+    unsigned long grows;
+    unsigned long recycle_searches;
+    hash_func hash;
+    cmp_func cmp;
+};
+
+/* Distance between successive probes of hash */
+static inline unsigned long rh_step(struct table *ta, unsigned long hash)
+{
+    return ta->linear ? 1 : ta->step_prime - (hash % ta->step_prime);
+}
+
+#define ALIVE_WORDS(size) (((size) + 63) / 64)
+
+static inline void rh_set_alive(struct table *ta, size_t pos)
+{
+    ta->alivemap[pos >> 6] |= 1ULL << (pos & 63);
+}
+
+static inline void rh_clear_alive(struct table *ta, size_t pos)
+{
+    ta->alivemap[pos >> 6] &= ~(1ULL << (pos & 63));
+}
+
+/* First live slot at or after pos, or ta->size. Scans the bitmap a word
+ * (64 slots) at a time, so sparse tables skip their empty stretches
+ * without touching the slots.
+ */
+static inline size_t rh_next_alive(struct table *ta, size_t pos)
+{
+    size_t w = pos >> 6, words = ALIVE_WORDS(ta->size);
+    uint64_t bits;
+
+    if(pos >= ta->size)
+        return ta->size;
+    bits = ta->alivemap[w] & (~0ULL << (pos & 63));
+    while(!bits) {
+        if(++w >= words)
+            return ta->size;
+        bits = ta->alivemap[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+}
+
+/* Robin hood internals for modules that already hold the stored hash */
+ssize_t rh_search_hash(struct table *ta, unsigned long hash, void *key, size_t keylen);
+int rh_insert_hash(struct table *ta, unsigned long hash, void *key, size_t keylen, void *data);
+void rh_prefetch_hash(struct table *ta, unsigned long hash);
+void rh_prefetch_insert(struct table *ta, unsigned long hash);
+
+/* Alternative engines. cfg has hash/cmp filled in by table_new_ex */
+table_t cuckoo_new(const struct table_config *cfg);
+table_t hopscotch_new(const struct table_config *cfg);
+table_t auto_new(const struct table_config *cfg);
+
+/* Hand the auto table's trace hook on to its inner table */
+void auto_set_trace(table_t t);
+
+/* Unordered spill list for entries an engine could not place (e.g. more
+ * identical hashes than a bucket/neighbourhood holds). Lookups only
+ * touch it when it is non-empty.
+ */
+struct overflow_entry {
+    unsigned long hash;
+    void *key;
+    void *data;
+    size_t keylen;
+};
+
+struct overflow {
+    struct overflow_entry *e;
+    size_t n;
+    size_t cap;
+};
+
+struct overflow_entry *overflow_find(struct overflow *o, cmp_func cmp, unsigned long hash, void *key, size_t keylen);
+int overflow_room(struct overflow *o);
+int overflow_add(struct overflow *o, unsigned long hash, void *key, size_t keylen, void *data);
+void overflow_del(struct overflow *o, struct overflow_entry *e);
+int overflow_copy(struct overflow *dst, const struct overflow *src);
+
+#endif
@@ -0,0 +1,927 @@
+/* Round trips and regressions for every engine behind table.h.
+ *
+ * usage: test_table
+ *
+ * Each check that fails prints its line and the run exits non-zero.
+ * Keys are stored with their terminating NUL, so the built-in compare
+ * (strncmp over the lookup length) matches whole keys only.
+ *
+ * Built and run by `make test`.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "table.h"
+
+#define KEYS 20000
+#define KEYLEN 16
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, engine, #cond); \
+        failures++; \
+    } \
+} while(0)
+
+static char keys[KEYS][KEYLEN];
+static const char *engine = "";
+
+static void *key(long i)
+{
+    return keys[i];
+}
+
+static size_t keylen(long i)
+{
+    return strlen(keys[i]) + 1;
+}
+
+static table_t new_table(enum table_engine e)
+{
+    struct table_config cfg = { e, NULL, NULL, TABLE_PROBE_DOUBLE, 0, 0 };
+    engine = table_engine_name(e);
+    return table_new_ex(&cfg);
+}
+
+static struct table_stats stats(table_t t)
+{
+    struct table_stats st;
+    memset(&st, 0, sizeof(st));
+    table_get_stats(t, &st);
+    return st;
+}
+
+static int count_visit(void *arg, void *k, size_t len, void *data)
+{
+    long i = (long)data;
+
+    (*(long *)arg)++;
+    return len != keylen(i) || memcmp(k, key(i), len) ? -1 : 0;
+}
+
+static int stop_visit(void *arg, void *k, size_t len, void *data)
+{
+    (void)k;
+    (void)len;
+    (void)data;
+    return ++*(long *)arg == 10 ? 7 : 0;
+}
+
+struct order {
+    const char *last;
+    size_t lastlen;
+    long n;
+    int bad;
+};
+
+/* Keys must arrive in memcmp order, the shorter first on a common prefix */
+static int order_visit(void *arg, void *k, size_t len, void *data)
+{
+    struct order *o = arg;
+    int c;
+
+    (void)data;
+    if(o->last) {
+        c = memcmp(o->last, k, len < o->lastlen ? len : o->lastlen);
+        o->bad += c > 0 || (c == 0 && o->lastlen >= len);
+    }
+    o->last = k;
+    o->lastlen = len;
+    o->n++;
+    return 0;
+}
+
+static int odd(void *arg, void *k, size_t len, void *data)
+{
+    (void)arg;
+    (void)k;
+    (void)len;
+    return (long)data % 2;
+}
+
+static void test_round_trip(enum table_engine e)
+{
+    table_t t = new_table(e);
+    void *d;
+    long i, n = 0;
+
+    CHECK(t != NULL);
+    for(i = 0; i < KEYS; i++)
+        CHECK(table_insert(t, key(i), keylen(i), (void *)i) == 0);
+    CHECK(stats(t).elements == KEYS);
+
+    for(i = 0; i < KEYS; i++) {
+        CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+        CHECK(table_fetch_key(t, key(i), keylen(i)) != NULL);
+    }
+    CHECK(table_get(t, "absent", 7, &d) != 0 && d == NULL);
+
+    CHECK(table_iter(t, count_visit, &n) == 0);
+    CHECK(n == KEYS);
+    n = 0;
+    CHECK(table_iter(t, stop_visit, &n) == 7);
+    CHECK(n == 10);
+    n = 0;
+    CHECK(table_iter_sorted(t, TABLE_ORDER_KEY, stop_visit, &n, 1) == 7);
+    CHECK(n == 10);
+
+    for(i = 0; i < KEYS; i += 2)
+        CHECK(table_remove(t, key(i), keylen(i)) == 0);
+    CHECK(table_remove(t, key(0), keylen(0)) != 0);
+    CHECK(stats(t).elements == KEYS / 2);
+    for(i = 0; i < KEYS; i++)
+        CHECK((table_get(t, key(i), keylen(i), &d) == 0) == (i % 2));
+
+    /* removed keys go back in */
+    for(i = 0; i < KEYS; i += 2)
+        CHECK(table_insert(t, key(i), keylen(i), (void *)i) == 0);
+    for(i = 0; i < KEYS; i++)
+        CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+    table_free(t);
+}
+
+static void test_batch(enum table_engine e)
+{
+    static void *ks[KEYS], *ds[KEYS];
+    static size_t lens[KEYS];
+    static int results[KEYS];
+    table_t t = new_table(e);
+    size_t size;
+    void *d;
+    long i;
+
+    for(i = 0; i < KEYS; i++) {
+        ks[i] = key(i);
+        lens[i] = keylen(i);
+        ds[i] = (void *)i;
+    }
+    for(i = 0; i < KEYS; i += 1000)
+        CHECK(table_insert_batch(t, ks + i, lens + i, ds + i, 1000, results + i) == 0);
+    for(i = 0; i < KEYS; i++)
+        CHECK(results[i] == 0 && table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+    CHECK(stats(t).elements == KEYS);
+
+    /* a batch of updates adds no keys and so needs no room */
+    size = stats(t).size;
+    CHECK(table_insert_batch(t, ks, lens, ds, KEYS, NULL) == 0);
+    CHECK(stats(t).size == size);
+    CHECK(stats(t).elements == KEYS);
+    table_free(t);
+}
+
+static void test_reserve(enum table_engine e)
+{
+    table_t t = new_table(e);
+    size_t size;
+    void *d;
+    long i;
+
+    CHECK(table_reserve(t, KEYS) == 0);
+    size = stats(t).size;
+    for(i = 0; i < KEYS; i++)
+        CHECK(table_insert(t, key(i), keylen(i), (void *)i) == 0);
+    CHECK(stats(t).size == size);
+
+    /* a reserve that already fits changes nothing */
+    CHECK(table_reserve(t, 0) == 0);
+    CHECK(stats(t).size == size);
+    for(i = 0; i < KEYS; i++)
+        CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+    table_free(t);
+}
+
+static void test_erase_if(enum table_engine e, int flags)
+{
+    table_t t = new_table(e);
+    struct table_stats st;
+    size_t size;
+    void *d;
+    long i;
+
+    for(i = 0; i < KEYS; i++)
+        table_insert(t, key(i), keylen(i), (void *)i);
+    size = stats(t).size;
+
+    CHECK(table_erase_if(t, odd, NULL, flags) == KEYS / 2);
+    st = stats(t);
+    CHECK(st.elements == KEYS / 2);
+    CHECK(st.erased == KEYS / 2);
+    CHECK(st.removes == 0);
+    CHECK(flags & TABLE_ERASE_SHRINK ? st.size <= size : st.size == size);
+    for(i = 0; i < KEYS; i++)
+        CHECK((table_get(t, key(i), keylen(i), &d) == 0) == !(i % 2));
+
+    CHECK(table_erase_if(t, odd, NULL, flags) == 0);
+    for(i = 1; i < KEYS; i += 2)
+        CHECK(table_insert(t, key(i), keylen(i), (void *)i) == 0);
+    for(i = 0; i < KEYS; i++)
+        CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+    table_free(t);
+}
+
+static void test_iter_sorted(enum table_engine e)
+{
+    table_t t = new_table(e);
+    unsigned int nthreads;
+    long i, n;
+
+    for(i = 0; i < KEYS; i++)
+        table_insert(t, key(i), keylen(i), (void *)i);
+
+    for(nthreads = 1; nthreads <= 4; nthreads += 3) {
+        struct order o = { NULL, 0, 0, 0 };
+        CHECK(table_iter_sorted(t, TABLE_ORDER_KEY, order_visit, &o, nthreads) == 0);
+        CHECK(o.n == KEYS && o.bad == 0);
+    }
+    n = 0;
+    CHECK(table_iter_sorted(t, TABLE_ORDER_HASH, count_visit, &n, 1) == 0);
+    CHECK(n == KEYS);
+
+    /* the stop value comes back from the middle of the walk too */
+    n = -KEYS / 2;
+    CHECK(table_iter_sorted(t, TABLE_ORDER_HASH, stop_visit, &n, 1) == 7);
+    CHECK(n == 10);
+    table_free(t);
+}
+
+static int none(void *arg, void *k, size_t len, void *data)
+{
+    (void)arg;
+    (void)k;
+    (void)len;
+    (void)data;
+    return 0;
+}
+
+/* A shrinking sweep clears tombstones left by earlier removes even when
+ * it erases nothing itself: a third of the keys removed leaves too many
+ * to shrink the table but tombstones in over a quarter of its slots
+ */
+static void test_erase_tombstones(void)
+{
+    table_t t = new_table(TABLE_ENGINE_ROBIN_HOOD);
+    struct table_slot *slots;
+    size_t n = 0, i, dead = 0, size;
+    void *d;
+    long j;
+
+    for(j = 0; j < KEYS; j++)
+        table_insert(t, key(j), keylen(j), (void *)j);
+    for(j = 0; j < KEYS; j += 3)
+        table_remove(t, key(j), keylen(j));
+    size = stats(t).size;
+    CHECK(table_erase_if(t, none, NULL, TABLE_ERASE_SHRINK) == 0);
+    CHECK(stats(t).size == size);
+
+    table_dump_slots(t, NULL, &n);
+    slots = malloc(n * sizeof(*slots));
+    CHECK(slots && table_dump_slots(t, slots, &n) == 0);
+    for(i = 0; slots && i < n; i++)
+        dead += slots[i].state == TABLE_SLOT_DEAD;
+    CHECK(dead == 0);
+    free(slots);
+    for(j = 0; j < KEYS; j++)
+        CHECK((table_get(t, key(j), keylen(j), &d) == 0) == (j % 3 != 0));
+    table_free(t);
+}
+
+static void test_metrics(enum table_engine e)
+{
+    table_t t[2] = { new_table(e), new_table(e) };
+    const char *labels[2] = { "table=\"a\"", "table=\"b\"" };
+    static char buf[16384];
+    char small[64];
+    int len;
+    long i;
+
+    for(i = 0; i < KEYS; i++)
+        table_insert(t[0], key(i), keylen(i), (void *)i);
+    table_insert(t[1], key(0), keylen(0), NULL);
+
+    len = table_metrics_prometheus(t[0], labels[0], buf, sizeof(buf));
+    CHECK(len > 0 && len < (int)sizeof(buf) && (size_t)len == strlen(buf));
+    CHECK(strstr(buf, "# TYPE rh_table_elements gauge\n") != NULL);
+    CHECK(strstr(buf, "rh_table_elements{table=\"a\"} 20000\n") != NULL);
+    CHECK(strstr(buf, "rh_table_operations_total{table=\"a\",op=\"insert\"} 20000\n") != NULL);
+    CHECK(strstr(buf, "rh_table_probe_length_count{table=\"a\"} 20000\n") != NULL);
+
+    /* too small a buffer: the full length comes back, the output is cut */
+    CHECK(table_metrics_prometheus(t[0], labels[0], small, sizeof(small)) == len);
+    CHECK(strlen(small) == sizeof(small) - 1 && !strncmp(small, buf, sizeof(small) - 1));
+
+    len = table_metrics_prometheus_many(t, labels, 2, buf, sizeof(buf));
+    CHECK(len > 0 && (size_t)len == strlen(buf));
+    CHECK(strstr(buf, "rh_table_elements{table=\"a\"} 20000\nrh_table_elements{table=\"b\"} 1\n") != NULL);
+    table_free(t[0]);
+    table_free(t[1]);
+}
+
+/* A clone matches the original at the same size, then the two diverge */
+static void test_clone(enum table_engine e)
+{
+    table_t t = new_table(e), c;
+    struct table_stats st;
+    void *d;
+    long i;
+
+    for(i = 0; i < KEYS; i++)
+        table_insert(t, key(i), keylen(i), (void *)i);
+    for(i = 0; i < KEYS; i += 4)
+        table_remove(t, key(i), keylen(i));
+    st = stats(t);
+
+    c = table_clone(t);
+    CHECK(c != NULL);
+    CHECK(stats(c).size == st.size && stats(c).elements == st.elements);
+    for(i = 0; i < KEYS; i++)
+        CHECK((table_get(c, key(i), keylen(i), &d) == 0 && (long)d == i) == (i % 4 != 0));
+
+    for(i = 1; i < KEYS; i += 4)
+        table_remove(c, key(i), keylen(i));
+    table_insert(c, key(0), keylen(0), (void *)-1);
+    for(i = 0; i < KEYS; i++)
+        CHECK((table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i) == (i % 4 != 0));
+    CHECK(table_get(c, key(0), keylen(0), &d) == 0 && (long)d == -1);
+    CHECK(table_get(c, key(1), keylen(1), &d) != 0);
+    table_free(t);
+    table_free(c);
+}
+
+/* Interleave eight resumable lookups at a time, over present keys and
+ * absent ones; they must agree with table_get and count as gets
+ */
+static void test_lookup_steps(enum table_engine e)
+{
+    table_t t = new_table(e);
+    struct table_lookup l[8];
+    unsigned long gets, hits;
+    int st[8], left, j;
+    void *d[8];
+    long i;
+
+    for(i = 0; i < KEYS; i += 2)
+        table_insert(t, key(i), keylen(i), (void *)i);
+    for(i = 0; i < KEYS; i += 1000)
+        table_remove(t, key(i), keylen(i));
+    gets = stats(t).gets;
+    hits = stats(t).get_hits;
+
+    for(i = 0; i < KEYS; i += 8) {
+        for(j = 0; j < 8; j++) {
+            table_lookup_start(t, &l[j], key(i + j), keylen(i + j));
+            st[j] = TABLE_LOOKUP_PENDING;
+        }
+        for(left = 8; left;) {
+            for(j = 0; j < 8; j++) {
+                if(st[j] == TABLE_LOOKUP_PENDING && (st[j] = table_lookup_step(&l[j], &d[j])) != TABLE_LOOKUP_PENDING)
+                    left--;
+            }
+        }
+        for(j = 0; j < 8; j++) {
+            int present = (i + j) % 2 == 0 && (i + j) % 1000 != 0;
+            CHECK(present ? st[j] == 0 && (long)d[j] == i + j : st[j] == -1);
+        }
+    }
+    CHECK(stats(t).gets == gets + KEYS);
+    CHECK(stats(t).get_hits == hits + KEYS / 2 - KEYS / 1000);
+    table_free(t);
+}
+
+/* Sampling every access: key 1 is read 1000 times and key 2 500 times
+ * against one read of the rest, so they top the hot list in that order
+ */
+static void test_sampler(enum table_engine e)
+{
+    table_t t = new_table(e);
+    struct table_sample hot[4], longp[4];
+    size_t n, j;
+    void *d;
+    long i;
+
+    CHECK(table_sampler_enable(t, 0, 0) != 0);
+    CHECK(table_sampler_enable(t, 4, 0) == 0);
+    for(i = 0; i < KEYS; i++)
+        table_insert(t, key(i), keylen(i), (void *)i);
+    for(i = 0; i < 1000; i++)
+        table_get(t, key(1), keylen(1), &d);
+    for(i = 0; i < 500; i++)
+        table_get(t, key(2), keylen(2), &d);
+
+    CHECK(table_sampler_hot(t, hot, 4) == 4);
+    CHECK(hot[0].keylen == keylen(1) && !memcmp(hot[0].key, key(1), keylen(1)) && hot[0].count >= 1001);
+    CHECK(hot[1].keylen == keylen(2) && !memcmp(hot[1].key, key(2), keylen(2)) && hot[1].count >= 501);
+    n = table_sampler_long_probes(t, longp, 4);
+    CHECK(n > 0);
+    for(j = 1; j < n; j++)
+        CHECK(longp[j - 1].count >= longp[j].count);
+
+    table_sampler_disable(t);
+    CHECK(table_sampler_hot(t, hot, 4) == 0);
+    table_free(t);
+}
+
+/* A snapshot keeps seeing the values and keys it opened on while later
+ * writes update and delete them, and collection frees only the versions
+ * no snapshot can reach
+ */
+static void test_mvcc(enum table_engine e)
+{
+    struct table_config cfg = { e, NULL, NULL, TABLE_PROBE_DOUBLE, 0, 0 };
+    mvcc_t mv = table_mvcc_new(&cfg);
+    unsigned long snap, now;
+    void *d;
+    long i;
+
+    engine = table_engine_name(e);
+    CHECK(mv != NULL);
+    for(i = 0; i < 1000; i++)
+        CHECK(table_mvcc_put(mv, key(i), keylen(i), (void *)i) == 0);
+    CHECK(table_mvcc_version(mv) == 1000);
+    /* with no snapshot open a write frees the version it replaces */
+    CHECK(table_mvcc_put(mv, key(0), keylen(0), (void *)0) == 0);
+    CHECK(table_mvcc_gc(mv) == 0);
+
+    CHECK(table_snapshot_open(mv, &snap) == 0);
+    for(i = 0; i < 500; i++)
+        CHECK(table_mvcc_put(mv, key(i), keylen(i), (void *)(i + KEYS)) == 0);
+    for(i = 500; i < 600; i++)
+        CHECK(table_mvcc_del(mv, key(i), keylen(i)) == 0);
+    CHECK(table_mvcc_del(mv, key(500), keylen(500)) != 0);
+    CHECK(table_mvcc_del(mv, key(KEYS - 1), keylen(KEYS - 1)) != 0);
+    CHECK(table_mvcc_put(mv, key(KEYS - 1), keylen(KEYS - 1), NULL) == 0);
+    now = table_mvcc_version(mv);
+
+    for(i = 0; i < 1000; i++) {
+        CHECK(table_mvcc_get(mv, key(i), keylen(i), snap, &d) == 0 && (long)d == i);
+        if(i < 500)
+            CHECK(table_mvcc_get(mv, key(i), keylen(i), now, &d) == 0 && (long)d == i + KEYS);
+        else
+            CHECK((table_mvcc_get(mv, key(i), keylen(i), now, &d) == 0) == (i >= 600));
+    }
+    CHECK(table_mvcc_get(mv, key(KEYS - 1), keylen(KEYS - 1), snap, &d) != 0);
+    CHECK(table_mvcc_get(mv, key(KEYS - 1), keylen(KEYS - 1), now, &d) == 0);
+
+    /* the snapshot still needs every version it sees; a second update
+     * strands the one between it and the head
+     */
+    CHECK(table_mvcc_gc(mv) == 0);
+    CHECK(table_mvcc_put(mv, key(0), keylen(0), (void *)-1) == 0);
+    CHECK(table_mvcc_gc(mv) == 1);
+    CHECK(table_mvcc_get(mv, key(0), keylen(0), snap, &d) == 0 && (long)d == 0);
+
+    table_snapshot_close(mv, snap);
+    CHECK(table_mvcc_gc(mv) == 0);
+    now = table_mvcc_version(mv);
+    CHECK(table_mvcc_get(mv, key(0), keylen(0), now, &d) == 0 && (long)d == -1);
+    for(i = 1; i < 1000; i++)
+        CHECK((table_mvcc_get(mv, key(i), keylen(i), now, &d) == 0) == (i < 500 || i >= 600));
+    table_mvcc_free(mv);
+}
+
+/* A batch lands at one version or not at all */
+static void test_mvcc_apply(enum table_engine e)
+{
+    struct table_config cfg = { e, NULL, NULL, TABLE_PROBE_DOUBLE, 0, 0 };
+    static struct table_mvcc_op ops[1001];
+    mvcc_t mv = table_mvcc_new(&cfg);
+    unsigned long before, snap;
+    void *d;
+    long i;
+
+    engine = table_engine_name(e);
+    for(i = 0; i < 1000; i++) {
+        ops[i].op = TABLE_MVCC_PUT;
+        ops[i].key = key(i);
+        ops[i].keylen = keylen(i);
+        ops[i].data = (void *)i;
+    }
+    CHECK(table_mvcc_apply(mv, ops, 1000) == 0);
+    CHECK(table_mvcc_version(mv) == 1);
+    CHECK(table_snapshot_open(mv, &snap) == 0);
+
+    /* deletes and updates in one commit; a later op on a key wins */
+    for(i = 0; i < 100; i++) {
+        ops[i].op = TABLE_MVCC_DEL;
+        ops[i + 100].data = (void *)-1;
+    }
+    ops[1000] = ops[150];
+    ops[1000].data = (void *)-2;
+    CHECK(table_mvcc_apply(mv, ops, 1001) == 0);
+    CHECK(table_mvcc_version(mv) == 2);
+    for(i = 0; i < 1000; i++) {
+        CHECK(table_mvcc_get(mv, key(i), keylen(i), snap, &d) == 0 && (long)d == i);
+        if(i < 100)
+            CHECK(table_mvcc_get(mv, key(i), keylen(i), 2, &d) != 0);
+        else
+            CHECK(table_mvcc_get(mv, key(i), keylen(i), 2, &d) == 0
+                  && (long)d == (i == 150 ? -2 : i < 200 ? -1 : i));
+    }
+
+    /* deleting an absent key fails the whole batch, new keys included */
+    before = table_mvcc_version(mv);
+    ops[0].op = TABLE_MVCC_PUT;
+    ops[0].key = key(KEYS - 1);
+    ops[0].keylen = keylen(KEYS - 1);
+    ops[1].op = TABLE_MVCC_DEL;
+    ops[1].key = key(1);
+    ops[1].keylen = keylen(1);
+    ops[2].op = TABLE_MVCC_PUT;
+    ops[2].key = key(300);
+    ops[2].keylen = keylen(300);
+    ops[2].data = NULL;
+    CHECK(table_mvcc_apply(mv, ops, 3) != 0);
+    CHECK(table_mvcc_version(mv) == before);
+    CHECK(table_mvcc_get(mv, key(KEYS - 1), keylen(KEYS - 1), before, &d) != 0);
+    CHECK(table_mvcc_get(mv, key(300), keylen(300), before, &d) == 0 && (long)d == 300);
+
+    table_snapshot_close(mv, snap);
+    table_mvcc_free(mv);
+}
+
+/* Four buckets ten units wide: counts fall out of the window a bucket
+ * at a time, and keys with nothing left in it are reclaimed
+ */
+static void test_window(enum table_engine e)
+{
+    struct table_config cfg = { e, NULL, NULL, TABLE_PROBE_DOUBLE, 0, 0 };
+    window_t w = table_window_new(4, 10, &cfg);
+    long i;
+
+    engine = table_engine_name(e);
+    CHECK(w != NULL);
+    CHECK(table_window_new(0, 10, &cfg) == NULL && table_window_new(4, 0, &cfg) == NULL);
+
+    CHECK(table_window_add(w, key(0), keylen(0), 1, 0) == 0);
+    CHECK(table_window_add(w, key(0), keylen(0), 1, 5) == 0);
+    CHECK(table_window_add(w, key(0), keylen(0), 1, 15) == 0);
+    CHECK(table_window_add(w, key(0), keylen(0), 2, 25) == 0);
+    CHECK(table_window_add(w, key(0), keylen(0), 1, 35) == 0);
+    /* late, but still inside the window */
+    CHECK(table_window_add(w, key(0), keylen(0), 1, 12) == 0);
+    CHECK(table_window_count(w, key(0), keylen(0), 35) == 7);
+    CHECK(table_window_count(w, key(0), keylen(0), 40) == 5);
+    CHECK(table_window_count(w, key(0), keylen(0), 55) == 3);
+    CHECK(table_window_count(w, key(0), keylen(0), 79) == 0);
+    CHECK(table_window_count(w, key(1), keylen(1), 35) == 0);
+
+    for(i = 1; i < 1000; i++)
+        CHECK(table_window_add(w, key(i), keylen(i), i, 100) == 0);
+    /* the adds' own sweeps reclaimed key 0, which expired long ago; the
+     * rest go once their window has passed
+     */
+    CHECK(table_window_keys(w) == 999);
+    CHECK(table_window_count(w, key(999), keylen(999), 139) == 999);
+    CHECK(table_window_reclaim(w, 1000, 139) == 0);
+    CHECK(table_window_reclaim(w, 1000, 140) == 999);
+    CHECK(table_window_keys(w) == 0);
+    CHECK(table_window_count(w, key(999), keylen(999), 140) == 0);
+    table_window_free(w);
+}
+
+static unsigned long builtin_hash(const void *k, size_t len)
+{
+    struct table_hasher h;
+
+    table_hasher_init(&h);
+    table_hasher_update(&h, k, len);
+    return table_hasher_final(&h);
+}
+
+/* Every row of the export is a live entry with its own hash and value */
+static void test_export(enum table_engine e, unsigned int nthreads)
+{
+    table_t t = new_table(e);
+    struct table_columns cols;
+    static unsigned long hashes[KEYS];
+    static int64_t offsets[KEYS + 1];
+    static char keybuf[KEYS * KEYLEN];
+    static void *values[KEYS];
+    static char seen[KEYS];
+    size_t bytes = 0, i;
+    long j;
+
+    for(j = 0; j < KEYS; j++)
+        table_insert(t, key(j), keylen(j), (void *)j);
+    for(j = 0; j < KEYS; j++) {
+        if(j % 3 == 0)
+            table_remove(t, key(j), keylen(j));
+        else
+            bytes += keylen(j);
+    }
+
+    /* too small: nothing written, the needed sizes come back */
+    memset(&cols, 0, sizeof(cols));
+    cols.offsets = offsets;
+    cols.keys = keybuf;
+    CHECK(table_export_columns(t, &cols, nthreads) == -1);
+    CHECK(cols.rows == stats(t).elements && cols.key_bytes == bytes);
+
+    cols.hashes = hashes;
+    cols.values = values;
+    CHECK(table_export_columns(t, &cols, nthreads) == 0);
+    CHECK(cols.rows == stats(t).elements && cols.key_bytes == bytes);
+    CHECK(offsets[0] == 0 && (size_t)offsets[cols.rows] == bytes);
+    memset(seen, 0, sizeof(seen));
+    for(i = 0; i < cols.rows; i++) {
+        const char *k = keybuf + offsets[i];
+        size_t len = offsets[i + 1] - offsets[i];
+        j = (long)values[i];
+        CHECK(hashes[i] == builtin_hash(k, len));
+        CHECK(j > 0 && j < KEYS && j % 3 && !seen[j] && len == keylen(j) && !memcmp(k, key(j), len));
+        if(j > 0 && j < KEYS)
+            seen[j] = 1;
+    }
+    table_free(t);
+}
+
+static unsigned long fnv_hash(void *k, size_t len)
+{
+    const unsigned char *p = k;
+    unsigned long h = 14695981039346656037UL;
+
+    while(len--)
+        h = (h ^ *p++) * 1099511628211UL;
+    return h;
+}
+
+static int bytes_cmp(void *a, void *b, size_t len)
+{
+    return memcmp(a, b, len);
+}
+
+/* Each key split in three parts (the last may be empty) finds the whole
+ * key, through the in-place path with the built-in hash and compare and
+ * the concatenating one with the caller's
+ */
+static void test_get_parts(enum table_engine e)
+{
+    struct table_keypart parts[3];
+    int custom;
+    void *d;
+    long i;
+
+    for(custom = 0; custom < 2; custom++) {
+        struct table_config cfg = { e, custom ? fnv_hash : NULL, custom ? bytes_cmp : NULL,
+                                    TABLE_PROBE_DOUBLE, 0, 0 };
+        table_t t = table_new_ex(&cfg);
+
+        engine = table_engine_name(e);
+        for(i = 0; i < KEYS; i += 2)
+            table_insert(t, key(i), keylen(i), (void *)i);
+        for(i = 0; i < KEYS; i++) {
+            size_t len = keylen(i), a = len / 3, b = len / 2;
+            parts[0].base = key(i);
+            parts[0].len = a;
+            parts[1].base = (char *)key(i) + a;
+            parts[1].len = b - a;
+            parts[2].base = (char *)key(i) + b;
+            parts[2].len = len - b;
+            CHECK(i % 2 ? table_get_parts(t, parts, 3, &d) != 0
+                        : table_get_parts(t, parts, 3, &d) == 0 && (long)d == i);
+        }
+        parts[0].base = key(4);
+        parts[0].len = keylen(4);
+        CHECK(table_get_parts(t, parts, 1, &d) == 0 && (long)d == 4);
+        table_free(t);
+    }
+}
+
+/* The hasher fed a key in pieces gives the built-in hash, which
+ * table_get_hashed and table_insert_hashed accept in place of hashing
+ */
+static void test_hashed(enum table_engine e)
+{
+    table_t t = new_table(e);
+    struct table_hasher h;
+    unsigned long hash;
+    void *d;
+    long i;
+    size_t j;
+
+    for(i = 0; i < KEYS; i++) {
+        table_hasher_init(&h);
+        for(j = 0; j < keylen(i); j++)
+            table_hasher_update(&h, (char *)key(i) + j, 1);
+        hash = table_hasher_final(&h);
+        CHECK(hash == builtin_hash(key(i), keylen(i)));
+        if(i % 2)
+            CHECK(table_insert(t, key(i), keylen(i), (void *)i) == 0);
+        else
+            CHECK(table_insert_hashed(t, hash, key(i), keylen(i), (void *)i) == 0);
+    }
+    CHECK(stats(t).inserts == KEYS);
+    for(i = 0; i < KEYS; i++) {
+        CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+        CHECK(table_get_hashed(t, builtin_hash(key(i), keylen(i)), key(i), keylen(i), &d) == 0 && (long)d == i);
+    }
+    CHECK(table_get_hashed(t, builtin_hash("absent", 7), "absent", 7, &d) != 0 && d == NULL);
+    table_free(t);
+}
+
+/* a holds keys [0, 2/3), b keys [1/3, 1) with values offset by KEYS, so
+ * each result value shows which side it came from. b's engine differs
+ * from a's on the second pass to take the table_iter/table_get path.
+ */
+static void test_setops(enum table_engine e, unsigned int nthreads)
+{
+    table_t a = new_table(e), b, out;
+    void *d;
+    long i;
+
+    b = new_table(nthreads > 1 ? e : (e + 1) % TABLE_ENGINE_COUNT);
+    engine = table_engine_name(e);
+    for(i = 0; i < KEYS * 2 / 3; i++)
+        table_insert(a, key(i), keylen(i), (void *)i);
+    for(i = KEYS / 3; i < KEYS; i++)
+        table_insert(b, key(i), keylen(i), (void *)(i + KEYS));
+
+    CHECK(table_union(a, a, b, nthreads) != 0);
+
+    out = new_table(e);
+    CHECK(table_union(out, a, b, nthreads) == 0);
+    CHECK(stats(out).elements == KEYS);
+    for(i = 0; i < KEYS; i++)
+        CHECK(table_get(out, key(i), keylen(i), &d) == 0 && (long)d == (i < KEYS * 2 / 3 ? i : i + KEYS));
+    table_free(out);
+
+    out = new_table(e);
+    CHECK(table_intersect(out, a, b, nthreads) == 0);
+    CHECK(stats(out).elements == KEYS * 2 / 3 - KEYS / 3);
+    for(i = KEYS / 3; i < KEYS * 2 / 3; i++)
+        CHECK(table_get(out, key(i), keylen(i), &d) == 0 && (long)d == i);
+    table_free(out);
+
+    out = new_table(e);
+    CHECK(table_difference(out, a, b, nthreads) == 0);
+    CHECK(stats(out).elements == KEYS / 3);
+    for(i = 0; i < KEYS / 3; i++)
+        CHECK(table_get(out, key(i), keylen(i), &d) == 0 && (long)d == i);
+    table_free(out);
+
+    table_free(a);
+    table_free(b);
+}
+
+/* Keys 0-4 come 1000, 900, ... 600 times among 5000 single sightings, so
+ * space-saving with 16 counters must rank them first, in order, with
+ * counts that bound their true frequency from above by at most error
+ */
+static void test_topk(enum table_engine e)
+{
+    struct table_config cfg = { e, NULL, NULL, TABLE_PROBE_DOUBLE, 0, 0 };
+    struct table_topk_item items[16];
+    static void *ks[KEYS];
+    static size_t lens[KEYS];
+    topk_t tk, tb;
+    size_t n;
+    long i, j;
+
+    engine = table_engine_name(e);
+    tk = table_topk_new(16, &cfg);
+    tb = table_topk_new(16, &cfg);
+    CHECK(tk && tb);
+    for(i = 0, n = 0; i < 5000; i++) {
+        for(j = 0; j < 5; j++) {
+            if(i % 5 == 0 && i / 5 < 1000 - j * 100) {
+                ks[n] = key(j);
+                lens[n++] = keylen(j);
+            }
+        }
+        ks[n] = key(5 + i);
+        lens[n++] = keylen(5 + i);
+    }
+    for(i = 0; i < (long)n; i++)
+        CHECK(table_topk_add(tk, ks[i], lens[i], 1) == 0);
+    CHECK(table_topk_add_batch(tb, ks, lens, n) == 0);
+
+    CHECK(table_topk_list(tk, items, 16) == 16);
+    for(j = 0; j < 5; j++) {
+        CHECK(items[j].keylen == keylen(j) && !memcmp(items[j].key, key(j), keylen(j)));
+        CHECK(items[j].count >= (unsigned long)(1000 - j * 100));
+        CHECK(items[j].count - items[j].error <= (unsigned long)(1000 - j * 100));
+    }
+    CHECK(table_topk_list(tb, items, 5) == 5);
+    for(j = 0; j < 5; j++)
+        CHECK(items[j].keylen == keylen(j) && !memcmp(items[j].key, key(j), keylen(j)));
+
+    /* weights add up like repeats */
+    CHECK(table_topk_add(tk, key(KEYS - 1), keylen(KEYS - 1), 5000) == 0);
+    CHECK(table_topk_list(tk, items, 1) == 1 && items[0].count >= 5000);
+    CHECK(items[0].keylen == keylen(KEYS - 1) && !memcmp(items[0].key, key(KEYS - 1), keylen(KEYS - 1)));
+    table_topk_free(tk);
+    table_topk_free(tb);
+}
+
+/* Every key hashes to ULONG_MAX, so with linear probing the first probe,
+ * hash + 1, wraps to slot 0 whatever the table's size
+ */
+static unsigned long edge_hash(void *k, size_t len)
+{
+    (void)k;
+    (void)len;
+    return ULONG_MAX;
+}
+
+/* Regression: robin hood get/remove/fetch took a key found in slot 0 for
+ * a miss (pos > 0 where pos >= 0 was meant)
+ */
+static void test_slot_zero(void)
+{
+    struct table_config cfg = { TABLE_ENGINE_ROBIN_HOOD, edge_hash, NULL, TABLE_PROBE_LINEAR, 0, 0 };
+    struct table_slot *slots;
+    size_t n = 0;
+    table_t t;
+    void *d;
+
+    engine = "robinhood slot 0";
+    t = table_new_ex(&cfg);
+    CHECK(table_insert(t, key(7), keylen(7), (void *)7) == 0);
+    table_dump_slots(t, NULL, &n);
+    slots = malloc(n * sizeof(*slots));
+    CHECK(slots && table_dump_slots(t, slots, &n) == 0);
+    CHECK(slots && slots[0].state == TABLE_SLOT_ALIVE);
+    free(slots);
+
+    CHECK(table_get(t, key(7), keylen(7), &d) == 0 && (long)d == 7);
+    CHECK(table_fetch_key(t, key(7), keylen(7)) != NULL);
+    CHECK(table_fetch_val(t, key(7), keylen(7)) == (void *)7);
+    CHECK(table_remove(t, key(7), keylen(7)) == 0);
+    CHECK(table_get(t, key(7), keylen(7), &d) != 0);
+    table_free(t);
+}
+
+/* Regression: rh_insert_hash worked out the probe stride before growing,
+ * so the key whose insert grew the table was placed along the old stride
+ * and could not be found again. Check every key straight after each grow.
+ */
+static void test_stride_after_grow(void)
+{
+    table_t t;
+    unsigned long grows = 0;
+    void *d;
+    long i, j;
+
+    for(j = 0; j < 2; j++) {
+        struct table_config cfg = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL,
+                                    j ? TABLE_PROBE_LINEAR : TABLE_PROBE_DOUBLE, 0.5, 1.5 };
+        engine = j ? "robinhood linear grow" : "robinhood grow";
+        t = table_new_ex(&cfg);
+        for(i = 0; i < KEYS; i++) {
+            CHECK(table_insert(t, key(i), keylen(i), (void *)i) == 0);
+            if(stats(t).grows != grows) {
+                grows = stats(t).grows;
+                CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+            }
+        }
+        for(i = 0; i < KEYS; i++)
+            CHECK(table_get(t, key(i), keylen(i), &d) == 0 && (long)d == i);
+        table_free(t);
+        grows = 0;
+    }
+}
+
+int main(void)
+{
+    enum table_engine e;
+    long i;
+
+    for(i = 0; i < KEYS; i++)
+        snprintf(keys[i], KEYLEN, "%ld", i);
+
+    for(e = 0; e < TABLE_ENGINE_COUNT; e++) {
+        test_round_trip(e);
+        test_batch(e);
+        test_reserve(e);
+        test_erase_if(e, 0);
+        test_erase_if(e, TABLE_ERASE_SHRINK);
+        test_iter_sorted(e);
+        test_topk(e);
+        test_metrics(e);
+        test_clone(e);
+        test_lookup_steps(e);
+        test_sampler(e);
+        test_mvcc(e);
+        test_mvcc_apply(e);
+        test_window(e);
+        test_export(e, 1);
+        test_export(e, 4);
+        test_get_parts(e);
+        test_hashed(e);
+        test_setops(e, 1);
+        test_setops(e, 4);
+    }
+    test_erase_tombstones();
+    test_slot_zero();
+    test_stride_after_grow();
+
+    if(failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
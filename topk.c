@@ -0,0 +1,231 @@
+/* Streaming top-k with space-saving counters.
+ *
+ * k counters, each owning a copy of its key, are indexed by a table and
+ * ordered by a min-heap on count. A key that has a counter is bumped in
+ * place; a new key takes over the smallest counter, inheriting its count
+ * as the error bound. Any key seen more than total/k times is guaranteed
+ * a counter, and memory stays at k keys whatever the stream length.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+#define TOPK_INFLIGHT 8
+
+struct counter {
+    void *key;                  /* owned copy, NULL while unused */
+    size_t keylen;
+    unsigned long count;
+    unsigned long error;
+    unsigned long gen;          /* bumped each time the counter changes key */
+    size_t heappos;
+};
+
+struct topk {
+    table_t t;                  /* key -> counter index */
+    struct counter *c;
+    size_t *heap;               /* counter indices, smallest count first */
+    size_t k;
+    size_t used;
+};
+
+topk_t table_topk_new(size_t k, const struct table_config *cfg)
+{
+    struct table_config def = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL };
+    struct topk *tk;
+
+    if(k == 0 || !(tk = calloc(1, sizeof(*tk))))
+        return NULL;
+    tk->k = k;
+    tk->c = calloc(k, sizeof(*tk->c));
+    tk->heap = malloc(k * sizeof(*tk->heap));
+    /* k + 1: an eviction indexes the new key before dropping the old */
+    if(!tk->c || !tk->heap || !(tk->t = table_new_ex(cfg ? cfg : &def)) || table_reserve(tk->t, k + 1)) {
+        table_free(tk->t);
+        free(tk->c);
+        free(tk->heap);
+        free(tk);
+        return NULL;
+    }
+    return tk;
+}
+
+void table_topk_free(topk_t p)
+{
+    struct topk *tk = p;
+    size_t i = 0;
+
+    if(!tk)
+        return;
+    for(; i < tk->used; i++)
+        free(tk->c[i].key);
+    table_free(tk->t);
+    free(tk->c);
+    free(tk->heap);
+    free(tk);
+}
+
+static void heap_set(struct topk *tk, size_t pos, size_t idx)
+{
+    tk->heap[pos] = idx;
+    tk->c[idx].heappos = pos;
+}
+
+/* A count only ever grows, so a bumped counter can only move down */
+static void sift_down(struct topk *tk, size_t pos)
+{
+    size_t idx = tk->heap[pos], child;
+    unsigned long count = tk->c[idx].count;
+
+    while((child = 2 * pos + 1) < tk->used) {
+        if(child + 1 < tk->used && tk->c[tk->heap[child + 1]].count < tk->c[tk->heap[child]].count)
+            child++;
+        if(tk->c[tk->heap[child]].count >= count)
+            break;
+        heap_set(tk, pos, tk->heap[child]);
+        pos = child;
+    }
+    heap_set(tk, pos, idx);
+}
+
+static void sift_up(struct topk *tk, size_t pos)
+{
+    size_t idx = tk->heap[pos], parent;
+    unsigned long count = tk->c[idx].count;
+
+    for(; pos > 0; pos = parent) {
+        parent = (pos - 1) / 2;
+        if(tk->c[tk->heap[parent]].count <= count)
+            break;
+        heap_set(tk, pos, tk->heap[parent]);
+    }
+    heap_set(tk, pos, idx);
+}
+
+static void bump(struct topk *tk, size_t idx, unsigned long weight)
+{
+    tk->c[idx].count += weight;
+    sift_down(tk, tk->c[idx].heappos);
+}
+
+/* Give key a counter: a free one while there are any, else the smallest.
+ * The key is indexed before the counter changes, so a failed insert
+ * leaves everything as it was.
+ */
+static int claim(struct topk *tk, void *key, size_t keylen, unsigned long weight)
+{
+    struct counter *c;
+    unsigned long floor = 0;
+    size_t idx = tk->used < tk->k ? tk->used : tk->heap[0];
+    void *copy;
+
+    if(!(copy = malloc(keylen ? keylen : 1)))
+        return -1;
+    memcpy(copy, key, keylen);
+    if(table_insert(tk->t, copy, keylen, (void *)(uintptr_t)idx)) {
+        free(copy);
+        return -1;
+    }
+
+    c = &tk->c[idx];
+    if(tk->used < tk->k) {
+        tk->used++;
+        heap_set(tk, idx, idx);
+    } else {
+        floor = c->count;
+        table_remove(tk->t, c->key, c->keylen);
+        free(c->key);
+    }
+
+    c->key = copy;
+    c->keylen = keylen;
+    c->count = floor + weight;
+    c->error = floor;
+    c->gen++;
+    sift_up(tk, c->heappos);
+    sift_down(tk, c->heappos);
+    return 0;
+}
+
+int table_topk_add(topk_t p, void *key, size_t keylen, unsigned long weight)
+{
+    struct topk *tk = p;
+    void *d;
+
+    if(table_get(tk->t, key, keylen, &d) == 0) {
+        bump(tk, (uintptr_t)d, weight);
+        return 0;
+    }
+    return claim(tk, key, keylen, weight);
+}
+
+/* Batched form: look up TOPK_INFLIGHT keys at once with interleaved
+ * lookups, then apply them in order. A counter that changed key since
+ * its lookup (an eviction earlier in the group) sends that key back
+ * through the single-key path.
+ */
+int table_topk_add_batch(topk_t p, void **keys, const size_t *keylens, size_t n)
+{
+    struct topk *tk = p;
+    struct table_lookup l[TOPK_INFLIGHT];
+    size_t idx[TOPK_INFLIGHT], i = 0, j, k, left;
+    unsigned long gen[TOPK_INFLIGHT];
+    int st[TOPK_INFLIGHT], ret = 0;
+    void *d;
+
+    for(; i < n; i += k) {
+        k = n - i < TOPK_INFLIGHT ? n - i : TOPK_INFLIGHT;
+        for(j = 0; j < k; j++) {
+            table_lookup_start(tk->t, &l[j], keys[i + j], keylens[i + j]);
+            st[j] = TABLE_LOOKUP_PENDING;
+        }
+        for(left = k; left;) {
+            for(j = 0; j < k; j++) {
+                if(st[j] != TABLE_LOOKUP_PENDING || (st[j] = table_lookup_step(&l[j], &d)) == TABLE_LOOKUP_PENDING)
+                    continue;
+                if(st[j] == 0) {
+                    idx[j] = (uintptr_t)d;
+                    gen[j] = tk->c[idx[j]].gen;
+                }
+                left--;
+            }
+        }
+
+        for(j = 0; j < k; j++) {
+            if(st[j] == 0 && tk->c[idx[j]].gen == gen[j])
+                bump(tk, idx[j], 1);
+            else if(table_topk_add(tk, keys[i + j], keylens[i + j], 1))
+                ret = -1;
+        }
+    }
+    return ret;
+}
+
+static int by_count(const void *a, const void *b)
+{
+    const struct table_topk_item *x = a, *y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+size_t table_topk_list(topk_t p, struct table_topk_item *out, size_t n)
+{
+    struct topk *tk = p;
+    struct table_topk_item *all;
+    size_t i = 0;
+
+    if(!(all = malloc((tk->used ? tk->used : 1) * sizeof(*all))))
+        return 0;
+    for(; i < tk->used; i++) {
+        all[i].key = tk->c[i].key;
+        all[i].keylen = tk->c[i].keylen;
+        all[i].count = tk->c[i].count;
+        all[i].error = tk->c[i].error;
+    }
+    qsort(all, tk->used, sizeof(*all), by_count);
+    n = n < tk->used ? n : tk->used;
+    memcpy(out, all, n * sizeof(*out));
+    free(all);
+    return n;
+}
@@ -0,0 +1,197 @@
+/* Sliding-window per-key counters.
+ *
+ * Each key owns one allocation holding a ring of bucket counters, its
+ * key copy and the epoch (time / bucket width) of the newest bucket.
+ * Rings are brought forward lazily: an add clears the buckets the key
+ * skipped since it was last touched, and a read sums only the buckets
+ * still inside the window, so nothing runs per tick.
+ *
+ * Keys whose whole ring has expired are reclaimed a few at a time. The
+ * counters also sit in a dense array, and a cursor sweeps it: every add
+ * checks WINDOW_SWEEP entries and table_window_reclaim does more on
+ * demand.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+#define WINDOW_SWEEP 2
+#define WINDOW_MAX_BUCKETS 1024
+
+struct wcounter {
+    unsigned long long epoch;   /* epoch of the newest bucket */
+    size_t idx;                 /* position in the dense array */
+    size_t keylen;
+    unsigned long counts[];     /* nbuckets counters, then the key */
+};
+
+struct window {
+    table_t t;                  /* key -> counter */
+    struct wcounter **all;
+    size_t n;
+    size_t cap;
+    size_t cursor;
+    unsigned int nbuckets;
+    unsigned long long width;
+};
+
+static void *wc_key(struct window *w, struct wcounter *c)
+{
+    return &c->counts[w->nbuckets];
+}
+
+window_t table_window_new(unsigned int buckets, unsigned long long width, const struct table_config *cfg)
+{
+    struct table_config def = { TABLE_ENGINE_ROBIN_HOOD, NULL, NULL };
+    struct window *w;
+
+    if(buckets == 0 || buckets > WINDOW_MAX_BUCKETS || width == 0)
+        return NULL;
+    if(!(w = calloc(1, sizeof(*w))))
+        return NULL;
+    if(!(w->t = table_new_ex(cfg ? cfg : &def))) {
+        free(w);
+        return NULL;
+    }
+    w->nbuckets = buckets;
+    w->width = width;
+    return w;
+}
+
+void table_window_free(window_t p)
+{
+    struct window *w = p;
+    size_t i = 0;
+
+    if(!w)
+        return;
+    for(; i < w->n; i++)
+        free(w->all[i]);
+    free(w->all);
+    table_free(w->t);
+    free(w);
+}
+
+/* Sum of the buckets inside both the counter's ring and the window
+ * ending at epoch now
+ */
+static unsigned long wc_sum(struct window *w, struct wcounter *c, unsigned long long now)
+{
+    unsigned long long hi = now < c->epoch ? now : c->epoch, e, d = 0;
+    unsigned long sum = 0;
+
+    for(; d < w->nbuckets && d <= hi; d++) {
+        e = hi - d;
+        if(e + w->nbuckets <= now || e + w->nbuckets <= c->epoch)
+            break;
+        sum += c->counts[e % w->nbuckets];
+    }
+    return sum;
+}
+
+static void wc_drop(struct window *w, struct wcounter *c)
+{
+    table_remove(w->t, wc_key(w, c), c->keylen);
+    w->all[c->idx] = w->all[--w->n];
+    w->all[c->idx]->idx = c->idx;
+    free(c);
+}
+
+/* Check up to budget counters from the cursor and drop expired ones */
+static size_t sweep(struct window *w, size_t budget, unsigned long long now)
+{
+    struct wcounter *c;
+    size_t dropped = 0;
+
+    for(; budget && w->n; budget--) {
+        if(w->cursor >= w->n)
+            w->cursor = 0;
+        c = w->all[w->cursor];
+        if(c->epoch + w->nbuckets <= now) {
+            /* the last entry moves into the cursor slot, check it next */
+            wc_drop(w, c);
+            dropped++;
+        } else {
+            w->cursor++;
+        }
+    }
+    return dropped;
+}
+
+static struct wcounter *wc_new(struct window *w, void *key, size_t keylen, unsigned long long now)
+{
+    struct wcounter *c, **all;
+    size_t cap;
+
+    if(w->n == w->cap) {
+        cap = w->cap ? w->cap * 2 : 64;
+        if(!(all = realloc(w->all, cap * sizeof(*all))))
+            return NULL;
+        w->all = all;
+        w->cap = cap;
+    }
+    if(!(c = calloc(1, sizeof(*c) + w->nbuckets * sizeof(c->counts[0]) + keylen)))
+        return NULL;
+    c->epoch = now;
+    c->keylen = keylen;
+    memcpy(wc_key(w, c), key, keylen);
+    if(table_insert(w->t, wc_key(w, c), keylen, c)) {
+        free(c);
+        return NULL;
+    }
+    c->idx = w->n;
+    w->all[w->n++] = c;
+    return c;
+}
+
+int table_window_add(window_t p, void *key, size_t keylen, unsigned long n, unsigned long long time)
+{
+    struct window *w = p;
+    unsigned long long now = time / w->width, e;
+    struct wcounter *c;
+    void *d;
+
+    sweep(w, WINDOW_SWEEP, now);
+
+    if(table_get(w->t, key, keylen, &d) == 0) {
+        c = d;
+        if(now > c->epoch) {
+            if(now - c->epoch >= w->nbuckets)
+                memset(c->counts, 0, w->nbuckets * sizeof(c->counts[0]));
+            else
+                for(e = c->epoch + 1; e <= now; e++)
+                    c->counts[e % w->nbuckets] = 0;
+            c->epoch = now;
+        }
+    } else if(!(c = wc_new(w, key, keylen, now))) {
+        return -1;
+    }
+
+    /* a late add within the window still lands in its own bucket */
+    if(now + w->nbuckets > c->epoch)
+        c->counts[now % w->nbuckets] += n;
+    return 0;
+}
+
+unsigned long table_window_count(window_t p, void *key, size_t keylen, unsigned long long time)
+{
+    struct window *w = p;
+    void *d;
+
+    if(table_get(w->t, key, keylen, &d))
+        return 0;
+    return wc_sum(w, d, time / w->width);
+}
+
+size_t table_window_reclaim(window_t p, size_t budget, unsigned long long time)
+{
+    struct window *w = p;
+    return sweep(w, budget, time / w->width);
+}
+
+size_t table_window_keys(window_t p)
+{
+    struct window *w = p;
+    return w->n;
+}